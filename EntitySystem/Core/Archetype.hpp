@@ -0,0 +1,51 @@
+//
+//  Archetype.hpp
+//  EntitySystem
+//
+//  Created by Jeppe Nielsen on 17/10/26.
+//  Copyright © 2026 Jeppe Nielsen. All rights reserved.
+//
+
+#pragma once
+#include <vector>
+#include "GameIDHelper.hpp"
+
+namespace Pocket {
+
+    enum class StorageMode {
+        Containers,
+        Archetypes,
+    };
+
+    // A chunk holds up to ContainerPageSize objects of the same archetype.
+    // Every component of the archetype has one block (a page) in its container,
+    // and row n of the chunk is slot blocks[c] + n in each of them.
+    struct ArchetypeChunk {
+        ArchetypeChunk() : count(0) {}
+        std::vector<int> blocks;
+        std::vector<int> objects;
+        std::vector<bool> enabled;
+        int count;
+    };
+
+    struct Archetype {
+        ComponentMask mask;
+        std::vector<ComponentID> components;
+        std::vector<ArchetypeChunk> chunks;
+        std::vector<int> openChunks;
+
+        int Column(ComponentID id) const {
+            for(int i=0; i<components.size(); ++i) {
+                if (components[i] == id) return i;
+            }
+            return -1;
+        }
+    };
+
+    struct ArchetypeLocation {
+        ArchetypeLocation() : archetype(-1), chunk(-1), row(-1) {}
+        int archetype;
+        int chunk;
+        int row;
+    };
+}
@@ -0,0 +1,126 @@
+//
+//  CommandBuffer.hpp
+//  EntitySystem
+//
+//  Created by Jeppe Nielsen on 17/10/26.
+//  Copyright © 2026 Jeppe Nielsen. All rights reserved.
+//
+
+#pragma once
+#include <vector>
+#include <deque>
+#include <memory>
+#include "GameIDHelper.hpp"
+#include "GameObject.hpp"
+
+namespace Pocket {
+
+    // A deferred structural change, recorded by GameObject and replayed by GameWorld::Update.
+    struct Command {
+        enum class Type : unsigned char {
+            EnableComponent,
+            RemoveComponent,
+            RemoveObject,
+            UpdateEnabled,
+            EnableBatch,
+            RemoveBatch,
+            EnableComponents,
+            RemoveComponents,
+        };
+        Type type;
+        ComponentID component;
+        // slot of the object, kept since Remove clears GameObject::index, or the batch of batch commands
+        int index;
+        GameObject* object;
+    };
+
+    // Commands are plain records in one vector, which keeps its capacity when cleared,
+    // so recording does not allocate once the buffer has grown to the size of a frame.
+    class CommandBuffer {
+    public:
+        void Push(Command::Type type, GameObject* object, int index, ComponentID component = -1) {
+            commands.push_back({ type, component, index, object });
+        }
+
+        int Size() const { return (int)commands.size(); }
+        const Command& operator[](int index) const { return commands[index]; }
+        bool Empty() const { return commands.empty(); }
+        void Clear() { commands.clear(); }
+
+    private:
+        std::vector<Command> commands;
+    };
+
+    // Value of a component added by a system updating on a worker, copied into the component when replayed.
+    // Like AddComponent on the main thread, an object which already has the component keeps it as it is.
+    struct StagedComponent {
+        virtual ~StagedComponent() { }
+        virtual void AddTo(GameObject* object) = 0;
+    };
+
+    template<typename T>
+    struct Staged : public StagedComponent {
+        T value;
+        void AddTo(GameObject* object) override {
+            if (object->HasComponent<T>()) return;
+            *object->AddComponent<T>() = value;
+        }
+    };
+
+    // A call made by a system updating on a worker.
+    // Calls are ordered by system, then by step within the system's Update, a ParallelForEach is one step,
+    // then by the first object of the range, -1 outside ParallelForEach, and then by the order they were made.
+    // This is the order they would have been made in on a single thread, regardless of how the work was split.
+    struct RecordedCommand {
+        enum class Type : unsigned char {
+            CreateObject,
+            AddComponent,
+            ReferenceComponent,
+            CloneComponent,
+            ShareComponent,
+            RemoveComponent,
+            RemoveObject,
+            // source is the new parent
+            SetParent,
+            // component is 1 when enabled, else 0
+            SetEnabled,
+        };
+        Type type;
+        ComponentID component;
+        GameObject* object;
+        GameObject* source;
+        StagedComponent* value;
+        int system;
+        int step;
+        int item;
+        int sequence;
+
+        bool operator<(const RecordedCommand& other) const {
+            if (system != other.system) return system < other.system;
+            if (step != other.step) return step < other.step;
+            if (item != other.item) return item < other.item;
+            return sequence < other.sequence;
+        }
+    };
+
+    // Object created by a system updating on a worker, it stands in for the object until the calls are replayed.
+    // It has no components until then, and changes to its Parent and Enabled are recorded like other calls.
+    struct Placeholder : public GameObject {
+        Property<GameObject*> parent;
+        Property<bool> enabled;
+    };
+
+    // Calls recorded by one thread, only that thread writes to it, so recording takes no locks.
+    struct CommandRecorder {
+        std::vector<RecordedCommand> commands;
+        // objects created while recording, they stand in for the real objects until replayed
+        std::deque<Placeholder> placeholders;
+        std::vector<std::unique_ptr<StagedComponent>> values;
+
+        void Clear() {
+            commands.clear();
+            placeholders.clear();
+            values.clear();
+        }
+    };
+}
@@ -0,0 +1,113 @@
+//
+//  ComponentIndex.hpp
+//  EntitySystem
+//
+//  Created by Jeppe Nielsen on 17/10/26.
+//  Copyright © 2026 Jeppe Nielsen. All rights reserved.
+//
+
+#pragma once
+#include <vector>
+#include <algorithm>
+
+namespace Pocket {
+
+    // Index into the container of one component type, per object index.
+    // Indices are kept in pages of PageSize objects, a page is allocated when the first object in its range
+    // gets the component, and released by Trim when no object in it has the component anymore.
+    // Pages that aren't allocated point to one shared page of -1, so reads don't branch on them,
+    // and creating an object doesn't touch the index.
+    class ComponentIndex {
+    public:
+        static const int PageShift = 10;
+        static const int PageSize = 1 << PageShift;
+        static const int PageMask = PageSize - 1;
+
+        ComponentIndex() { }
+        ComponentIndex(ComponentIndex&& other) noexcept { Swap(other); }
+        ~ComponentIndex() { Clear(); }
+
+        // component index of the object, -1 when it doesn't have the component
+        int Get(int object) const {
+            unsigned page = (unsigned)object >> PageShift;
+            if (page>=pages.size()) return -1;
+            return pages[page][object & PageMask];
+        }
+
+        // unchecked, only for objects which have the component, eg. the objects of a system using it
+        int operator[](int object) const {
+            return pages[object >> PageShift][object & PageMask];
+        }
+
+        void Set(int object, int index) {
+            int page = object >> PageShift;
+            if (page>=pages.size()) {
+                if (index == -1) return;
+                pages.resize(page + 1, EmptyPage());
+                counts.resize(page + 1, 0);
+            }
+            int*& entries = pages[page];
+            if (entries == EmptyPage()) {
+                if (index == -1) return;
+                entries = new int[PageSize];
+                std::fill(entries, entries + PageSize, -1);
+            }
+            int& entry = entries[object & PageMask];
+            counts[page] += (index != -1) - (entry != -1);
+            entry = index;
+        }
+
+        void Swap(ComponentIndex& other) {
+            pages.swap(other.pages);
+            counts.swap(other.counts);
+        }
+
+        void Clear() {
+            for(auto entries : pages) {
+                if (entries != EmptyPage()) {
+                    delete[] entries;
+                }
+            }
+            pages.clear();
+            counts.clear();
+        }
+
+        // releases pages without components, and all pages from object index size
+        void Trim(int size) {
+            for(int i=0; i<pages.size(); ++i) {
+                if (pages[i] != EmptyPage() && (counts[i] == 0 || i >= ((size + PageMask) >> PageShift))) {
+                    delete[] pages[i];
+                    pages[i] = EmptyPage();
+                }
+            }
+            while (!pages.empty() && pages.back() == EmptyPage()) {
+                pages.pop_back();
+                counts.pop_back();
+            }
+        }
+
+        int PageCount() const {
+            int count = 0;
+            for(auto entries : pages) {
+                count += entries != EmptyPage();
+            }
+            return count;
+        }
+
+    private:
+        ComponentIndex(const ComponentIndex&) = delete;
+        ComponentIndex& operator=(const ComponentIndex&) = delete;
+
+        static int* EmptyPage() {
+            static int* page = [] () {
+                static int entries[PageSize];
+                std::fill(entries, entries + PageSize, -1);
+                return entries;
+            }();
+            return page;
+        }
+
+        std::vector<int*> pages;
+        std::vector<int> counts;
+    };
+}
@@ -0,0 +1,153 @@
+//
+//  ComponentMask.hpp
+//  EntitySystem
+//
+//  Created by Jeppe Nielsen on 17/10/26.
+//  Copyright © 2026 Jeppe Nielsen. All rights reserved.
+//
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+// number of component types a program can use, define it before including to raise or lower it
+#ifndef POCKET_MAX_COMPONENTS
+#define POCKET_MAX_COMPONENTS 128
+#endif
+
+namespace Pocket {
+
+    using ComponentID = int;
+    const ComponentID MaxComponents = POCKET_MAX_COMPONENTS;
+
+    // One bit per component type, in 64 bit words.
+    // Masks are combined and compared a whole word at a time, without early outs,
+    // so the loops over the fixed number of words are unrolled and vectorized.
+    class ComponentMask {
+    public:
+        using Word = std::uint64_t;
+        static const int Words = (MaxComponents + 63) / 64;
+
+        class Reference {
+        public:
+            Reference(Word& word, Word bit) : word(word), bit(bit) {}
+            operator bool() const { return (word & bit) != 0; }
+            Reference& operator=(bool value) {
+                if (value) {
+                    word |= bit;
+                } else {
+                    word &= ~bit;
+                }
+                return *this;
+            }
+            Reference& operator=(const Reference& other) { return *this = (bool)other; }
+        private:
+            Word& word;
+            Word bit;
+        };
+
+        ComponentMask() : words() {}
+
+        bool operator[](ComponentID id) const { return (words[id >> 6] >> (id & 63)) & 1; }
+        Reference operator[](ComponentID id) { return Reference(words[id >> 6], Word(1) << (id & 63)); }
+
+        ComponentMask operator&(const ComponentMask& other) const {
+            ComponentMask result;
+            for(int i=0; i<Words; ++i) {
+                result.words[i] = words[i] & other.words[i];
+            }
+            return result;
+        }
+
+        ComponentMask operator|(const ComponentMask& other) const {
+            ComponentMask result;
+            for(int i=0; i<Words; ++i) {
+                result.words[i] = words[i] | other.words[i];
+            }
+            return result;
+        }
+
+        ComponentMask operator~() const {
+            ComponentMask result;
+            for(int i=0; i<Words; ++i) {
+                result.words[i] = ~words[i];
+            }
+            if (MaxComponents % 64) {
+                result.words[Words - 1] &= (Word(1) << (MaxComponents % 64)) - 1;
+            }
+            return result;
+        }
+
+        bool operator==(const ComponentMask& other) const {
+            Word difference = 0;
+            for(int i=0; i<Words; ++i) {
+                difference |= words[i] ^ other.words[i];
+            }
+            return difference == 0;
+        }
+
+        bool operator!=(const ComponentMask& other) const { return !(*this == other); }
+
+        // true when every bit of other is set, ie. (*this & other) == other without the temporary
+        bool Contains(const ComponentMask& other) const {
+            Word missing = 0;
+            for(int i=0; i<Words; ++i) {
+                missing |= other.words[i] & ~words[i];
+            }
+            return missing == 0;
+        }
+
+        bool Intersects(const ComponentMask& other) const {
+            Word common = 0;
+            for(int i=0; i<Words; ++i) {
+                common |= words[i] & other.words[i];
+            }
+            return common != 0;
+        }
+
+        bool Any() const {
+            Word bits = 0;
+            for(int i=0; i<Words; ++i) {
+                bits |= words[i];
+            }
+            return bits != 0;
+        }
+
+        void Reset() {
+            for(int i=0; i<Words; ++i) {
+                words[i] = 0;
+            }
+        }
+
+        // calls function(ComponentID) for every set bit, in increasing order
+        template<typename Function>
+        void Iterate(Function&& function) const {
+            for(int i=0; i<Words; ++i) {
+                Word bits = words[i];
+                while (bits) {
+                    function(i * 64 + __builtin_ctzll(bits));
+                    bits &= bits - 1;
+                }
+            }
+        }
+
+        std::size_t Hash() const {
+            std::size_t hash = 0;
+            for(int i=0; i<Words; ++i) {
+                hash = hash * 31 + std::hash<Word>()(words[i]);
+            }
+            return hash;
+        }
+
+    private:
+        Word words[Words];
+    };
+}
+
+namespace std {
+    template<>
+    struct hash<Pocket::ComponentMask> {
+        std::size_t operator()(const Pocket::ComponentMask& mask) const { return mask.Hash(); }
+    };
+}
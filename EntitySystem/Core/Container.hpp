@@ -7,23 +7,54 @@
 //
 
 #pragma once
-#include <deque>
 #include <vector>
+#include <algorithm>
 #include <assert.h>
 #include <functional>
+#include <new>
+#include <type_traits>
 
 namespace Pocket {
 
+    // Entries are stored in fixed size pages, so a page is contiguous in memory.
+    // A page can either hold loose entries, handed out one by one by Create,
+    // or be reserved as a block, eg. one column of an archetype chunk.
+    const int ContainerPageShift = 8;
+    const int ContainerPageSize = 1 << ContainerPageShift;
+    const int ContainerPageMask = ContainerPageSize - 1;
+
     class IContainer {
     public:
         virtual ~IContainer() {}
         virtual int Create() = 0;
+        // creates amount entries and stores their indices, containers may place them next to each other
+        virtual void CreateMany(int amount, int* indices) {
+            for(int i=0; i<amount; ++i) {
+                indices[i] = Create();
+            }
+        }
         virtual void Reference(int index) = 0;
         virtual void Delete(int index) = 0;
         virtual int Clone(int index) = 0;
         virtual void* Get(int index) = 0;
+        virtual int ReferenceCount(int index) const = 0;
+        virtual bool CanCreateBlocks() const = 0;
+        virtual int CreateBlock() = 0;
+        virtual void DeleteBlock(int index) = 0;
+        virtual bool IsBlock(int index) const = 0;
+        virtual void Move(int from, int to) = 0;
+        virtual int Move(int from) = 0;
         virtual void Clear() = 0;
         virtual void Trim() = 0;
+        // Moves all entries into a new container and returns it, leaving this one cleared,
+        // so the entries can be destroyed elsewhere. Null when the container can't, then it is cleared in place.
+        virtual IContainer* Release() { return 0; }
+        // Moves a loose entry into the lowest unused entry before it, if any, and returns where the entry is.
+        // Only for entries with one reference, as the caller updates the index it had.
+        virtual int Compact(int index) { return index; }
+        // unused entries Compact and Trim can reclaim, and the size of an entry
+        virtual int FreeCount() const { return 0; }
+        virtual int EntrySize() const { return 0; }
         int Count() const { return count; }
         int count;
     };
@@ -31,48 +62,101 @@ namespace Pocket {
     template<typename T>
     class Container : public IContainer {
     public:
-        Container()  { count = 0; }
+        Container() : freeSorted(false), looseIndex(0), looseEnd(0) { count = 0; }
         virtual ~Container() { }
-    
+
         int Create() override {
-            int freeIndex;
-            if (freeIndicies.empty()) {
-                freeIndex = (int)references.size();
-                references.emplace_back(0);
-                entries.emplace_back(defaultObject);
-            } else {
-                freeIndex = freeIndicies.back();
-                freeIndicies.pop_back();
-                entries[freeIndex] = defaultObject;
-            }
-            
+            int freeIndex = AllocateLoose();
+            entries[freeIndex] = defaultObject;
             ++count;
             references[freeIndex] = 1;
             return freeIndex;
         }
-        
+
+        // entries are taken from the end of the loose page, not from freed entries, so they are contiguous
+        void CreateMany(int amount, int* indices) override {
+            for(int i=0; i<amount; ++i) {
+                if (looseIndex == looseEnd) {
+                    looseIndex = AllocatePage(PageType::Loose) << ContainerPageShift;
+                    looseEnd = looseIndex + ContainerPageSize;
+                }
+                int index = looseIndex++;
+                entries[index] = defaultObject;
+                references[index] = 1;
+                indices[i] = index;
+            }
+            count += amount;
+        }
+
         void Reference(int index) override {
             ++references[index];
         }
-        
+
         void Delete(int index) override {
             --references[index];
             if (references[index]==0) {
                 --count;
-                freeIndicies.push_back(index);
+                Reset(index);
+                if (!IsBlock(index)) {
+                    freeIndicies.push_back(index);
+                    freeSorted = false;
+                }
             }
         }
-        
+
         int Clone(int index) override {
             int cloneIndex = Create();
             entries[cloneIndex] = entries[index];
             return cloneIndex;
         }
-        
+
         void* Get(int index) override {
             return &entries[index];
         }
-        
+
+        T& operator[](int index) {
+            return entries[index];
+        }
+
+        int ReferenceCount(int index) const override {
+            return references[index];
+        }
+
+        bool CanCreateBlocks() const override { return true; }
+
+        int CreateBlock() override {
+            return AllocatePage(PageType::Block) << ContainerPageShift;
+        }
+
+        void DeleteBlock(int index) override {
+            int page = index >> ContainerPageShift;
+            assert(pageTypes[page] == PageType::Block);
+            pageTypes[page] = PageType::Free;
+            freePages.push_back(page);
+        }
+
+        bool IsBlock(int index) const override {
+            return pageTypes[index >> ContainerPageShift] == PageType::Block;
+        }
+
+        // moves an entry including its references into an unused slot, the source slot becomes unused
+        void Move(int from, int to) override {
+            entries[to] = std::move(entries[from]);
+            Reset(from);
+            references[to] = references[from];
+            references[from] = 0;
+            if (!IsBlock(from)) {
+                freeIndicies.push_back(from);
+                freeSorted = false;
+            }
+        }
+
+        int Move(int from) override {
+            int to = AllocateLoose();
+            Move(from, to);
+            return to;
+        }
+
         void Iterate(std::function<void(T* object)> function) {
             for(int i=0; i<references.size(); ++i) {
                 if (references[i] > 0) {
@@ -80,42 +164,186 @@ namespace Pocket {
                 }
             }
         }
-        
+
         void Clear() override {
-            entries.clear();
+            entries.Clear();
             references.clear();
+            freeIndicies.clear();
+            compacted.clear();
+            pageTypes.clear();
+            freePages.clear();
+            looseIndex = looseEnd = 0;
             count = 0;
         }
-        
+
+        IContainer* Release() override {
+            Container* released = new Container();
+            released->entries.Swap(entries);
+            released->references.swap(references);
+            released->freeIndicies.swap(freeIndicies);
+            released->compacted.swap(compacted);
+            Clear();
+            return released;
+        }
+
+        // Free entries are kept in descending order while compacting, so the lowest is taken first,
+        // also by Create. Entries moved from are set aside, they are past the ones moved to,
+        // and are usually released by Trim.
+        int Compact(int index) override {
+            if (IsBlock(index)) return index;
+            if (!freeSorted) {
+                freeIndicies.insert(freeIndicies.end(), compacted.begin(), compacted.end());
+                compacted.clear();
+                std::sort(freeIndicies.begin(), freeIndicies.end(), std::greater<int>());
+                freeSorted = true;
+            }
+            if (freeIndicies.empty() || freeIndicies.back()>index) return index;
+            int to = freeIndicies.back();
+            freeIndicies.pop_back();
+            entries[to] = std::move(entries[index]);
+            Reset(index);
+            references[to] = references[index];
+            references[index] = 0;
+            compacted.push_back(index);
+            return to;
+        }
+
+        int FreeCount() const override {
+            return (int)(freeIndicies.size() + compacted.size()) + looseEnd - looseIndex;
+        }
+
+        int EntrySize() const override { return (int)sizeof(T); }
+
         void Trim() override {
+            freeIndicies.insert(freeIndicies.end(), compacted.begin(), compacted.end());
+            compacted.clear();
+            freeSorted = false;
+            for(int i=looseIndex; i<looseEnd; ++i) {
+                freeIndicies.push_back(i);
+            }
+            looseIndex = looseEnd = 0;
+
             int smallestSize = 0;
             for(int i = (int)references.size() - 1; i>=0; --i) {
-                if (references[i]>0) {
+                if (references[i]>0 || IsBlock(i)) {
                     smallestSize = i + 1;
                     break;
                 }
             }
-            if (smallestSize<references.size()) {
-                references.resize(smallestSize);
-                entries.resize(smallestSize);
-                for(int i=0; i<freeIndicies.size(); ++i) {
-                    if (freeIndicies[i]>=smallestSize) {
-                        freeIndicies.erase(freeIndicies.begin() + i);
-                        --i;
-                    }
-                }
+
+            int pageCount = (smallestSize + ContainerPageMask) >> ContainerPageShift;
+            entries.Resize(pageCount);
+            references.resize(pageCount << ContainerPageShift);
+            pageTypes.resize(pageCount);
+
+            freeIndicies.erase(std::remove_if(freeIndicies.begin(), freeIndicies.end(), [smallestSize] (int index) {
+                return index >= smallestSize;
+            }), freeIndicies.end());
+            freePages.erase(std::remove_if(freePages.begin(), freePages.end(), [pageCount] (int page) {
+                return page >= pageCount;
+            }), freePages.end());
+
+            if (pageCount>0 && pageTypes[pageCount - 1] == PageType::Loose) {
+                looseIndex = smallestSize;
+                looseEnd = pageCount << ContainerPageShift;
             }
         }
-    
-        using Entries = std::deque<T>;
+
+        class Entries {
+        public:
+            Entries() = default;
+            Entries(const Entries& other) = delete;
+            ~Entries() { Clear(); }
+
+            T& operator[](int index) { return pages[index >> ContainerPageShift][index & ContainerPageMask]; }
+            const T& operator[](int index) const { return pages[index >> ContainerPageShift][index & ContainerPageMask]; }
+            int Size() const { return (int)pages.size() << ContainerPageShift; }
+
+            void AddPage() { pages.push_back(new T[ContainerPageSize]); }
+
+            void Resize(int pageCount) {
+                for(int i=pageCount; i<pages.size(); ++i) {
+                    delete[] pages[i];
+                }
+                pages.resize(pageCount);
+            }
+
+            void Clear() { Resize(0); }
+            void Swap(Entries& other) { pages.swap(other.pages); }
+        private:
+            std::vector<T*> pages;
+        };
         Entries entries;
-        
+
         using References = std::vector<int>;
         References references;
-        
+
         using FreeIndicies = std::vector<int>;
         FreeIndicies freeIndicies;
-        
+
         T defaultObject;
+
+    private:
+        FreeIndicies compacted;
+        bool freeSorted;
+        enum class PageType : char { Free, Loose, Block };
+        std::vector<PageType> pageTypes;
+        std::vector<int> freePages;
+        int looseIndex;
+        int looseEnd;
+
+        // Unused entries are constructed again, so state bound to the instance rather than its value,
+        // eg. Event bindings or a Property's batch, isn't handed to the next component using the entry.
+        void Reset(int index) {
+            T& entry = entries[index];
+            entry.~T();
+            new (&entry) T(defaultObject);
+        }
+
+        int AllocatePage(PageType type) {
+            int page;
+            if (freePages.empty()) {
+                page = (int)pageTypes.size();
+                pageTypes.push_back(type);
+                entries.AddPage();
+                references.resize(references.size() + ContainerPageSize, 0);
+            } else {
+                page = freePages.back();
+                freePages.pop_back();
+                pageTypes[page] = type;
+            }
+            return page;
+        }
+
+        int AllocateLoose() {
+            if (freeIndicies.empty() && !compacted.empty()) {
+                freeIndicies.swap(compacted);
+                freeSorted = false;
+            }
+            if (!freeIndicies.empty()) {
+                int index = freeIndicies.back();
+                freeIndicies.pop_back();
+                return index;
+            }
+            if (looseIndex == looseEnd) {
+                looseIndex = AllocatePage(PageType::Loose) << ContainerPageShift;
+                looseEnd = looseIndex + ContainerPageSize;
+            }
+            return looseIndex++;
+        }
+    };
+
+    template<typename...>
+    struct VoidType { using Type = void; };
+
+    // container used for a component type, Container<T> unless the component declares its own
+    template<typename T, typename = void>
+    struct ComponentContainer {
+        using Type = Container<typename std::remove_const<T>::type>;
+    };
+
+    template<typename T>
+    struct ComponentContainer<T, typename VoidType<typename T::Container>::Type> {
+        using Type = typename T::Container;
     };
-}
\ No newline at end of file
+}
@@ -6,17 +6,16 @@
 //  Copyright © 2016 Jeppe Nielsen. All rights reserved.
 //
 #pragma once
-#include <bitset>
 #include <array>
+#include <string>
 #include <functional>
+#include <type_traits>
+#include <assert.h>
 #include "Container.hpp"
+#include "ComponentMask.hpp"
 
 namespace Pocket {
     
-    using ComponentID = int;
-    const ComponentID MaxComponents = 64;
-    using ComponentMask = std::bitset<MaxComponents>;
-
     using SystemID = int;
     
     class GameIDHelper {
@@ -24,12 +23,19 @@ namespace Pocket {
         static ComponentID componentIDCounter;
         static SystemID systemIDCounter;
         
+        template<typename T>
+        static ComponentID UniqueComponentID() {
+            static ComponentID id = componentIDCounter++;
+            assert(id<MaxComponents);
+            return id;
+        }
+        
     public:
     
+        // const T has the same id as T, const is used by systems to declare read only access
         template<typename T>
         static ComponentID GetComponentID() {
-            static ComponentID id = componentIDCounter++;
-            return id;
+            return UniqueComponentID<typename std::remove_const<T>::type>();
         }
         
         template<typename T>
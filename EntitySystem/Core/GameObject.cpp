@@ -8,78 +8,107 @@
 
 #include "GameObject.hpp"
 #include <assert.h>
+#include <algorithm>
 #include "GameWorld.hpp"
 
 using namespace Pocket;
 
-const ObjectCollection& GameObject::Children() const { return data->children; }
-Property<GameObject*>& GameObject::Parent() { return data->Parent; }
-Property<bool>& GameObject::Enabled() { return data->Enabled; }
-DirtyProperty<bool>& GameObject::WorldEnabled() { return data->WorldEnabled; }
+const ObjectCollection& GameObject::Children() const {
+    assert(!IsPlaceholder());
+    return world->Children(this);
+}
+
+ObjectRange GameObject::Descendants() const {
+    assert(!IsPlaceholder());
+    return world->Descendants(this);
+}
+Property<GameObject*>& GameObject::Parent() {
+    if (IsPlaceholder()) return static_cast<Placeholder*>(this)->parent;
+    return world->objectProperties[slot].Parent;
+}
+
+Property<bool>& GameObject::Enabled() {
+    if (IsPlaceholder()) return static_cast<Placeholder*>(this)->enabled;
+    return world->objectProperties[slot].Enabled;
+}
+
+DirtyProperty<bool>& GameObject::WorldEnabled() {
+    assert(!IsPlaceholder());
+    return world->objectProperties[slot].WorldEnabled;
+}
+
+GameObjectHandle GameObject::Handle() const {
+    if (slot<0) return GameObjectHandle();
+    return { (std::uint32_t)slot, world->generations[slot] };
+}
 
 GameObject::GameObject()
     :
-    world(0), index(-1), data(0)
-{
-    data = new Data();
+    index(-1), slot(-1), world(0)
+{ }
 
-    data->Enabled = true;
-    data->Parent = 0;
+// called once when the world creates the slot, the bindings are kept when the slot is reused
+void GameObject::BindProperties() {
+    GameWorld::ObjectProperties& properties = world->objectProperties[slot];
+    properties.Enabled = true;
+    properties.Parent = 0;
     
-    data->Parent.Changed.Bind([this]() {
-        assert(data->Parent!=this);
-        GameObject* prevParent = data->Parent.PreviousValue();
-        GameObject* currentParent = data->Parent;
-        
-        if (index>=0) {
-            if (!prevParent) {
-                prevParent = &world->root;
-            }
-            if (!currentParent) {
-                currentParent = &world->root;
-            }
-        }
-        
-        if (prevParent) {
-            auto& children = prevParent->data->children;
-            children.erase(std::find(children.begin(), children.end(), this));
-            prevParent->data->WorldEnabled.HasBecomeDirty.Unbind(this, &GameObject::SetWorldEnableDirty);
-        }
-        
-        if (currentParent) {
-            auto& children = currentParent->data->children;
-            children.push_back(this);
-            currentParent->data->WorldEnabled.HasBecomeDirty.Bind(this, &GameObject::SetWorldEnableDirty);
-            
-            bool prevWorldEnabled = data->WorldEnabled;
-            data->WorldEnabled.MakeDirty();
-            if (data->WorldEnabled()!=prevWorldEnabled) {
-                SetWorldEnableDirty();
-            }
-        }
-    });
+    properties.Parent.Changed.Bind(this, &GameObject::ParentChanged);
     
-    data->WorldEnabled.Method = [this](bool& value) {
-        value = (data->Parent) ? data->Parent()->data->WorldEnabled && data->Enabled : data->Enabled;
+    properties.WorldEnabled.Method = [this](bool& value) {
+        GameWorld::ObjectProperties& properties = world->objectProperties[slot];
+        GameObject* parent = properties.Parent;
+        bool parentEnabled = !parent || parent == &world->root || parent->WorldEnabled();
+        value = parentEnabled && properties.Enabled;
     };
     
-    data->Enabled.Changed.Bind(this, &GameObject::SetWorldEnableDirty);
+    properties.Enabled.Changed.Bind(this, &GameObject::SetWorldEnableDirty);
 }
 
-GameObject::~GameObject() {
-    delete data;
+// the hierarchy is shared by all systems, so existing objects can't be reparented while recording
+void GameObject::ParentChanged() {
+    assert(!IsRecording());
+    GameWorld::ObjectProperties& properties = world->objectProperties[slot];
+    assert(properties.Parent!=this);
+    GameObject* prevParent = properties.Parent.PreviousValue();
+    GameObject* currentParent = properties.Parent;
+    
+    if (index>=0) {
+        if (!prevParent) {
+            prevParent = &world->root;
+        }
+        if (!currentParent) {
+            currentParent = &world->root;
+        }
+    }
+    
+    if (prevParent) {
+        world->Unlink(this, prevParent);
+    }
+    
+    if (currentParent) {
+        world->Link(this, currentParent);
+        
+        bool prevWorldEnabled = properties.WorldEnabled;
+        properties.WorldEnabled.MakeDirty();
+        if (properties.WorldEnabled()!=prevWorldEnabled) {
+            SetWorldEnableDirty();
+        }
+    }
 }
 
 bool GameObject::HasComponent(ComponentID id) const {
     assert(id<MaxComponents);
-    return data->activeComponents[id];
+    if (slot<0) return false;
+    return world->activeComponents[slot][id];
 }
 
 void* GameObject::GetComponent(ComponentID id) {
     assert(id<MaxComponents);
-    if (!data->activeComponents[id]) return 0;
+    if (slot<0) return 0;
+    if (!world->activeComponents[slot][id]) return 0;
     IContainer* container = world->components[id];
-    return container->Get(world->objectComponents[id][index]);
+    return container->Get(world->objectComponents[id].Get(index));
 }
 
 void GameObject::AddComponent(ComponentID id) {
@@ -88,12 +117,11 @@ void GameObject::AddComponent(ComponentID id) {
         return;
     }
     IContainer* container = world->components[id];
-    world->objectComponents[id][index] = container->Create();
-    data->activeComponents[id] = true;
+    world->objectComponents[id].Set(index, container->Create());
+    world->activeComponents[slot][id] = true;
+    world->SetArchetypeDirty(index);
     
-    world->createActions.emplace_back([this, id]() {
-        TrySetComponentEnabled(id, true);
-    });
+    world->createCommands.Push(Command::Type::EnableComponent, this, index, id);
 }
 
 void GameObject::AddComponent(ComponentID id, const GameObject* source) {
@@ -104,13 +132,28 @@ void GameObject::AddComponent(ComponentID id, const GameObject* source) {
     }
     IContainer* container = world->components[id];
     int referenceIndex = world->objectComponents[id][source->index];
-    world->objectComponents[id][index] = referenceIndex;
+    world->objectComponents[id].Set(index, referenceIndex);
     container->Reference(referenceIndex);
-    data->activeComponents[id] = true;
+    world->activeComponents[slot][id] = true;
+    world->SetArchetypeDirty(index);
+    if (world->storageMode == StorageMode::Archetypes && container->IsBlock(referenceIndex)) {
+        world->sharedRows.push_back({ id, referenceIndex, source->index, index });
+    }
     
-    world->createActions.emplace_back([this, id]() {
-        TrySetComponentEnabled(id, true);
-    });
+    // sharing a copy on write component shares it copy on write
+    if (world->IsCopyOnWrite(id, source->index)) {
+        world->SetCopyOnWrite(id, index, true);
+    }
+    
+    world->createCommands.Push(Command::Type::EnableComponent, this, index, id);
+}
+
+void GameObject::ShareComponent(ComponentID id, const GameObject* source) {
+    if (HasComponent(id)) {
+        return;
+    }
+    world->SetCopyOnWrite(id, source->index, true);
+    AddComponent(id, source);
 }
 
 void GameObject::CloneComponent(ComponentID id, const GameObject* source) {
@@ -121,100 +164,141 @@ void GameObject::CloneComponent(ComponentID id, const GameObject* source) {
     }
     
     IContainer* container = world->components[id];
-    world->objectComponents[id][index] = container->Clone(world->objectComponents[id][source->index]);
-    data->activeComponents[id] = true;
+    world->objectComponents[id].Set(index, container->Clone(world->objectComponents[id][source->index]));
+    world->activeComponents[slot][id] = true;
+    world->SetArchetypeDirty(index);
     
-    world->createActions.emplace_back([this, id]() {
-        TrySetComponentEnabled(id, true);
-    });
+    world->createCommands.Push(Command::Type::EnableComponent, this, index, id);
 }
 
 void GameObject::RemoveComponent(ComponentID id) {
     assert(id<MaxComponents);
-    if (!HasComponent(id)) {
+    if (world->Record(RecordedCommand::Type::RemoveComponent, this, id)) {
+        return;
+    }
+    if (!HasComponent(id) || index<0) {
         return;
     }
     
-    world->removeActions.emplace_back([this, id]() {
-        if (!data->activeComponents[id]) {
-           return; // might have been removed by earlier remove action, eg if two consecutive RemoveComponent<> was called
-        }
-        TrySetComponentEnabled(id, false);
-        IContainer* container = world->components[id];
-        container->Delete(world->objectComponents[id][index]);
-        world->objectComponents[id][index] = -1;
-        data->activeComponents[id] = false;
-    });
+    world->removeCommands.Push(Command::Type::RemoveComponent, this, index, id);
+}
+
+void GameObject::CommitRemoveComponent(ComponentID id, int localIndex) {
+    if (!world->activeComponents[slot][id]) {
+       return; // might have been removed by earlier remove action, eg if two consecutive RemoveComponent<> was called
+    }
+    TrySetComponentEnabled(id, false);
+    IContainer* container = world->components[id];
+    container->Delete(world->objectComponents[id][localIndex]);
+    world->objectComponents[id].Set(localIndex, -1);
+    world->SetCopyOnWrite(id, localIndex, false);
+    world->activeComponents[slot][id] = false;
+    world->SetArchetypeDirty(localIndex);
 }
 
 void GameObject::Remove() {
+    if (world->Record(RecordedCommand::Type::RemoveObject, this)) {
+        return;
+    }
     if (index<0) return;
-    int localIndex = index;
-    world->removeActions.emplace_back([this, localIndex]() {
-        SetEnabled(false);
-        world->objectsFreeIndicies.push_back(localIndex);
-        --world->objectCount;
-        index = -2;
-    });
+    world->removeCommands.Push(Command::Type::RemoveObject, this, index);
     index = -1;
-    data->Parent = 0;
-    for(auto child : data->children) {
+    ++world->generations[slot];
+    Parent() = 0;
+    // a removed child unlinks itself
+    while (GameObject* child = world->Node(this).firstChild) {
         child->Remove();
     }
 }
 
+void GameObject::CommitRemove(int localIndex) {
+    SetEnabled(false);
+    world->activeComponents[slot].Iterate([this, localIndex] (ComponentID id) {
+        world->components[id]->Delete(world->objectComponents[id][localIndex]);
+        world->objectComponents[id].Set(localIndex, -1);
+        world->SetCopyOnWrite(id, localIndex, false);
+    });
+    world->activeComponents[slot].Reset();
+    world->SetArchetypeDirty(localIndex);
+    world->objectsFreeIndicies.push_back(localIndex);
+    --world->objectCount;
+    index = -2;
+}
+
+bool GameObject::IsRecording() const {
+    return world && GameWorld::Recording().world == world;
+}
+
+bool GameObject::RecordReferenceComponent(ComponentID id, GameObject* source) {
+    return world->Record(RecordedCommand::Type::ReferenceComponent, this, id, source) != 0;
+}
+
+bool GameObject::RecordCloneComponent(ComponentID id, GameObject* source) {
+    return world->Record(RecordedCommand::Type::CloneComponent, this, id, source) != 0;
+}
+
+bool GameObject::RecordShareComponent(ComponentID id, GameObject* source) {
+    return world->Record(RecordedCommand::Type::ShareComponent, this, id, source) != 0;
+}
+
 void GameObject::TryAddComponentContainer(ComponentID id, std::function<IContainer *()> constructor) {
-    if (!world->components[id]) {
-        world->components[id] = constructor();
-    }
+    world->TryAddComponentContainer(id, constructor);
 }
 
+// children only depend on the parent when its world enabled value has been computed since last change
+// one command for the whole subtree, its components are enabled or disabled in one pass when replayed
 void GameObject::SetWorldEnableDirty() {
-    data->WorldEnabled.MakeDirty();
-    world->createActions.emplace_back([this](){
-        SetEnabled(data->WorldEnabled);
-    });
+    assert(!IsRecording());
+    world->SetWorldEnabledDirty(this);
+    world->createCommands.Push(Command::Type::UpdateEnabled, this, index);
+}
+
+void GameObject::MarkChanged(ComponentID id) {
+    assert(id<MaxComponents);
+    world->MarkChanged(id, slot);
 }
 
 void GameObject::SetEnabled(bool enabled) {
-    for(int i=0; i<MaxComponents; ++i) {
-        if (data->activeComponents[i]) {
-            TrySetComponentEnabled(i, enabled);
-        }
-    }
+    // a copy, since ObjectAdded may add components
+    ComponentMask active = world->activeComponents[slot];
+    active.Iterate([this, enabled] (ComponentID id) {
+        TrySetComponentEnabled(id, enabled);
+    });
 }
 
 void GameObject::TrySetComponentEnabled(ComponentID id, bool enable) {
     
     enable = enable && WorldEnabled();
 
-    bool isEnabled = data->enabledComponents[id];
+    bool isEnabled = world->enabledComponents[slot][id];
     if (isEnabled==enable) {
         return; //cannot double enable/disable components
     }
     
+    if (index>=0) {
+        world->SetArchetypeDirty(index);
+    }
+    
     if (enable) {
-        data->enabledComponents[id] = enable;
+        world->enabledComponents[slot][id] = enable;
+        world->MarkChanged(id, slot);
         if (id>=world->systemsPerComponent.size()) return; // component id is beyond systems
         auto& systemsUsingComponent = world->systemsPerComponent[id];
         for(auto s : systemsUsingComponent) {
-            bool isInterest = (data->enabledComponents & s->componentMask) == s->componentMask;
+            bool isInterest = world->enabledComponents[slot].Contains(s->componentMask);
             if (isInterest) {
-                s->objects.push_back(this);
-                s->ObjectAdded(this);
+                s->NotifyAdded(this);
             }
         }
     } else {
         if (id>=world->systemsPerComponent.size()) return; // component id is beyond systems
         auto& systemsUsingComponent = world->systemsPerComponent[id];
         for(auto s : systemsUsingComponent) {
-            bool wasInterest = (data->enabledComponents & s->componentMask) == s->componentMask;
+            bool wasInterest = world->enabledComponents[slot].Contains(s->componentMask);
             if (wasInterest) {
-                s->ObjectRemoved(this);
-                auto& objects = s->objects;
-                objects.erase(std::find(objects.begin(), objects.end(), this));
+                s->NotifyRemoved(this);
             }
         }
-        data->enabledComponents[id] = enable;
+        world->enabledComponents[slot][id] = enable;
     }
 }
@@ -7,6 +7,7 @@
 //
 
 #pragma once
+#include <cstdint>
 #include "GameIDHelper.hpp"
 #include "Property.hpp"
 #include "DirtyProperty.hpp"
@@ -20,8 +21,29 @@ namespace Pocket {
     
     using ObjectCollection = std::vector<GameObject*>;
     
+    // consecutive objects, eg. part of GameWorld::DepthFirst
+    struct ObjectRange {
+        GameObject* const* first;
+        GameObject* const* last;
+        GameObject* const* begin() const { return first; }
+        GameObject* const* end() const { return last; }
+        int size() const { return (int)(last - first); }
+        bool empty() const { return first == last; }
+        GameObject* operator[](int index) const { return first[index]; }
+    };
+    
     class GameWorld;
     
+    // Refers to an object by slot and generation, the generation of a slot changes when its object is removed,
+    // so a handle to a removed object resolves to null, also after the slot has been reused.
+    struct GameObjectHandle {
+        std::uint32_t slot = ~0u;
+        std::uint32_t generation = 0;
+        
+        bool operator==(const GameObjectHandle& other) const { return slot == other.slot && generation == other.generation; }
+        bool operator!=(const GameObjectHandle& other) const { return !(*this == other); }
+    };
+    
     class GameObject {
     public:
     
@@ -33,23 +55,44 @@ namespace Pocket {
         template<typename T>
         T* GetComponent();
         
+        // Systems updating on workers record these calls, and they are made when the workers are done.
+        // Until then AddComponent returns a staged value which is copied into the component,
+        // and AddComponent(source) and CloneComponent return 0.
         template<typename T>
         T* AddComponent() {
+            if (IsRecording()) {
+                return RecordAddComponent<T>();
+            }
             ComponentID id = GameIDHelper::GetComponentID<T>();
-            TryAddComponentContainer(id, [](){ return new Container<T>(); });
+            TryAddComponentContainer(id, [](){ return new typename ComponentContainer<T>::Type(); });
             AddComponent(id);
             return GetComponent<T>();
         }
         
         template<typename T>
         T* AddComponent(GameObject* source) {
-            AddComponent(GameIDHelper::GetComponentID<T>(), source);
+            ComponentID id = GameIDHelper::GetComponentID<T>();
+            if (RecordReferenceComponent(id, source)) return 0;
+            AddComponent(id, source);
             return GetComponent<T>();
         }
         
+        // Shares source's component copy on write. Reads through GetComponent<const T>() and const components
+        // of systems go to the shared component, the first GetComponent<T>(), or ForEach of a system writing T,
+        // gives the object its own copy. source's component becomes copy on write as well.
+        template<typename T>
+        const T* ShareComponent(GameObject* source) {
+            ComponentID id = GameIDHelper::GetComponentID<T>();
+            if (RecordShareComponent(id, source)) return 0;
+            ShareComponent(id, source);
+            return GetComponent<const T>();
+        }
+        
         template<typename T>
         T* CloneComponent(GameObject* source) {
-            CloneComponent(GameIDHelper::GetComponentID<T>(), source);
+            ComponentID id = GameIDHelper::GetComponentID<T>();
+            if (RecordCloneComponent(id, source)) return 0;
+            CloneComponent(id, source);
             return GetComponent<T>();
         }
         
@@ -58,15 +101,26 @@ namespace Pocket {
             RemoveComponent(GameIDHelper::GetComponentID<T>());
         };
         
+        // counts as a change of T for systems tracking changes, GetComponent<T>() marks it too
+        template<typename T>
+        void MarkChanged() {
+            MarkChanged(GameIDHelper::GetComponentID<T>());
+        }
+        
         void Remove();
         
+        // handle resolved by GameWorld::Resolve, objects created by systems on workers get theirs when replayed
+        GameObjectHandle Handle() const;
+        
+        // children in the order they were added, rebuilt when asked for after they have changed
         const ObjectCollection& Children() const;
+        // all descendants depth first, valid until the hierarchy changes, see GameWorld::DepthFirst
+        ObjectRange Descendants() const;
         Property<GameObject*>& Parent();
         Property<bool>& Enabled();
         DirtyProperty<bool>& WorldEnabled();
         
         GameObject();
-        ~GameObject();
         
     private:
         
@@ -79,27 +133,37 @@ namespace Pocket {
         void AddComponent(ComponentID id);
         void AddComponent(ComponentID id, const GameObject* source);
         void CloneComponent(ComponentID id, const GameObject* source);
+        void ShareComponent(ComponentID id, const GameObject* source);
         void RemoveComponent(ComponentID id);
+        void MarkChanged(ComponentID id);
+        void CommitRemoveComponent(ComponentID id, int localIndex);
+        bool IsRecording() const;
+        // created by a system on a worker, and not yet replayed
+        bool IsPlaceholder() const { return index<=-3; }
+        template<typename T>
+        T* RecordAddComponent();
+        bool RecordReferenceComponent(ComponentID id, GameObject* source);
+        bool RecordCloneComponent(ComponentID id, GameObject* source);
+        bool RecordShareComponent(ComponentID id, GameObject* source);
+        void CommitRemove(int localIndex);
         void TryAddComponentContainer(ComponentID id, std::function<IContainer*()> constructor);
         void SetWorldEnableDirty();
         void SetEnabled(bool enabled);
         void TrySetComponentEnabled(ComponentID id, bool enable);
         
-        struct Data {
-            Data() : activeComponents(0), enabledComponents(0) {}
-            ComponentMask activeComponents;
-            ComponentMask enabledComponents;
-            Property<GameObject*> Parent;
-            Property<bool> Enabled;
-            DirtyProperty<bool> WorldEnabled;
-            ObjectCollection children;
-        };
+        void BindProperties();
+        void ParentChanged();
         
+        // the object's masks, properties and children are kept by the world, indexed by slot
         int index;
+        // position in the world, unlike index it is kept while the object is being removed
+        int slot;
         GameWorld* world;
-        Data* data;
         
         friend class Container<GameObject>;
         friend class GameWorld;
+        friend class IGameSystem;
+        template<typename...> friend class GameSystem;
+        template<typename, typename> friend class HierarchySystem;
     };
 }
\ No newline at end of file
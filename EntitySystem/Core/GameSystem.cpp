@@ -11,18 +11,141 @@
 
 using namespace Pocket;
 
-IGameSystem::IGameSystem() : world(0) {}
+IGameSystem::IGameSystem() : world(0), stableOrder(false), compactPending(false),
+trackChanges(false), changeVersion(0),
+notificationCount(0), batchedNotifications(false), notifyPending(false) {}
 IGameSystem::~IGameSystem() {}
 
 void IGameSystem::TryAddComponentContainer(ComponentID id, std::function<IContainer *()> constructor) {
-    if (!world->components[id]) {
-        world->components[id] = constructor();
-    }
+    world->TryAddComponentContainer(id, constructor);
 }
 
 void IGameSystem::Initialize() {}
 void IGameSystem::ObjectAdded(Pocket::GameObject *object) {}
 void IGameSystem::ObjectRemoved(Pocket::GameObject *object) {}
+
+void IGameSystem::ObjectsAdded(const ObjectCollection& objects) {
+    for(auto object : objects) {
+        ObjectAdded(object);
+    }
+}
+
+void IGameSystem::ObjectsRemoved(const ObjectCollection& objects) {
+    for(auto object : objects) {
+        ObjectRemoved(object);
+    }
+}
+
+void IGameSystem::ObjectsCleared() {
+    ObjectsRemoved(objects);
+}
+
 void IGameSystem::Update(float dt) {}
 void IGameSystem::Render() {}
-const ObjectCollection& IGameSystem::Objects() const { return objects; }
\ No newline at end of file
+const ObjectCollection& IGameSystem::Objects() const { return objects; }
+
+void IGameSystem::SetStableOrder(bool stable) {
+    stableOrder = stable;
+}
+
+void IGameSystem::SetBatchedNotifications(bool batched) {
+    batchedNotifications = batched;
+}
+
+void IGameSystem::TrackChanges() {
+    if (trackChanges) return;
+    trackChanges = true;
+    world->TrackChanges(componentMask, 1);
+}
+
+void IGameSystem::AddObject(GameObject* object) {
+    if (object->slot>=objectPositions.size()) {
+        objectPositions.resize(object->slot + 1, -1);
+    }
+    objectPositions[object->slot] = (int)objects.size();
+    objects.push_back(object);
+}
+
+void IGameSystem::ClearObjects() {
+    if (!objects.empty()) {
+        ObjectsCleared();
+    }
+    objects.clear();
+    objectPositions.clear();
+}
+
+void IGameSystem::RemoveObject(GameObject* object) {
+    int position = objectPositions[object->slot];
+    objectPositions[object->slot] = -1;
+    if (stableOrder) {
+        if (!compactPending) {
+            compactPending = true;
+            world->systemsToCompact.push_back(this);
+        }
+        return;
+    }
+    GameObject* last = objects.back();
+    objects[position] = last;
+    objectPositions[last->slot] = position;
+    objects.pop_back();
+}
+
+// keeps entries whose object still points at them, an object removed and added again has a newer entry
+void IGameSystem::CompactObjects() {
+    int count = 0;
+    for(int i=0; i<objects.size(); ++i) {
+        GameObject* object = objects[i];
+        if (objectPositions[object->slot] == i) {
+            objectPositions[object->slot] = count;
+            objects[count++] = object;
+        }
+    }
+    objects.resize(count);
+    compactPending = false;
+}
+void IGameSystem::NotifyAdded(GameObject* object) {
+    AddObject(object);
+    if (batchedNotifications) {
+        Notify(object, true);
+    } else {
+        ObjectAdded(object);
+    }
+}
+
+void IGameSystem::NotifyRemoved(GameObject* object) {
+    if (batchedNotifications) {
+        Notify(object, false);
+    } else {
+        ObjectRemoved(object);
+    }
+    RemoveObject(object);
+}
+
+void IGameSystem::Notify(GameObject* object, bool added) {
+    if (!notifyPending) {
+        notifyPending = true;
+        world->systemsToNotify.push_back(this);
+    }
+    if (notificationCount == 0 || notifications[notificationCount - 1].added != added) {
+        if (notificationCount == notifications.size()) {
+            notifications.emplace_back();
+        }
+        Notification& notification = notifications[notificationCount++];
+        notification.added = added;
+        notification.objects.clear();
+    }
+    notifications[notificationCount - 1].objects.push_back(object);
+}
+
+void IGameSystem::FlushNotifications() {
+    for(int i=0; i<notificationCount; ++i) {
+        const Notification& notification = notifications[i];
+        if (notification.added) {
+            ObjectsAdded(notification.objects);
+        } else {
+            ObjectsRemoved(notification.objects);
+        }
+    }
+    notificationCount = 0;
+    notifyPending = false;
+}
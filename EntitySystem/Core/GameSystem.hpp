@@ -8,8 +8,11 @@
 
 #pragma once
 #include <vector>
+#include <utility>
+#include <type_traits>
 #include "GameIDHelper.hpp"
 #include "GameObject.hpp"
+#include "ThreadPool.hpp"
 
 namespace Pocket {
     
@@ -26,22 +29,151 @@ namespace Pocket {
         virtual void ObjectRemoved(GameObject* object);
         virtual void Update(float dt);
         virtual void Render();
+        
+        // By default a removed object is replaced by the last object of the system.
+        // With stable order, objects keep the order they were added in, removed objects are
+        // taken out in one pass when the world has applied its changes.
+        void SetStableOrder(bool stable);
+        
+        // With batched notifications, ObjectAdded and ObjectRemoved aren't called as each object changes.
+        // Instead ObjectsAdded and ObjectsRemoved are called once the world has applied its changes, with all
+        // objects added and removed since. Calls keep the order of the changes, so an object removed and added
+        // again is in a removed collection followed by an added one.
+        // Components of removed objects may be gone by then, so they are best used as keys.
+        void SetBatchedNotifications(bool batched);
+        
+        // Keeps a change version for every component of the system, see GameSystem::ForEachChanged.
+        // Must be called from Initialize.
+        void TrackChanges();
+        virtual void ObjectsAdded(const ObjectCollection& objects);
+        virtual void ObjectsRemoved(const ObjectCollection& objects);
+        
+        // Called once by GameWorld::Clear instead of ObjectRemoved for every object, while the objects and
+        // their components still exist. Calls ObjectsRemoved with all objects by default.
+        virtual void ObjectsCleared();
     private:
         ObjectCollection objects;
+        // position in objects for every object slot in the world, -1 when the object isn't in the system
+        std::vector<int> objectPositions;
+        bool stableOrder;
+        bool compactPending;
+        bool trackChanges;
+        std::uint32_t changeVersion;
+        void AddObject(GameObject* object);
+        void RemoveObject(GameObject* object);
+        void CompactObjects();
+        void ClearObjects();
+        
+        // consecutive changes of the same kind, reused between flushes
+        struct Notification {
+            bool added;
+            ObjectCollection objects;
+        };
+        std::vector<Notification> notifications;
+        int notificationCount;
+        bool batchedNotifications;
+        bool notifyPending;
+        void NotifyAdded(GameObject* object);
+        void NotifyRemoved(GameObject* object);
+        void Notify(GameObject* object, bool added);
+        void FlushNotifications();
         ComponentMask componentMask;
+        ComponentMask writeMask;
         friend class GameObject;
+        template<typename...> friend class GameSystem;
+        template<typename, typename> friend class HierarchySystem;
     public:
         const ObjectCollection& Objects() const;
     };
     
+    // Components are written by the system, a const component is only read,
+    // eg. GameSystem<Transform, const Velocity>. Systems that don't write the same
+    // components may run concurrently when the world has workers.
     template<typename ...T>
     class GameSystem : public IGameSystem {
+    public:
+        // Calls function(T&...) or function(GameObject*, T&...) for every object in the system.
+        // Component storage is resolved once per call, rather than once per GetComponent.
+        template<typename Function>
+        void ForEach(Function&& function);
+        
+        // Like ForEach, but the objects are split into ranges which run on the world's workers.
+        // function is called concurrently, and should only touch the components it is given.
+        template<typename Function>
+        void ParallelForEach(Function&& function, int grainSize = 0, Partition partition = Partition::Adaptive);
+        
+        // Like ForEach, but only for objects where one of the components was added, enabled or written since
+        // the system's last ForEachChanged, the first call visits every object. Writes through the components
+        // function is given don't count as changes for the system itself. Requires TrackChanges.
+        template<typename Function>
+        void ForEachChanged(Function&& function);
+        
     private:
+        template<typename Function>
+        struct TakesObject {
+            template<typename F>
+            static std::true_type Test(decltype(std::declval<F&>()(std::declval<GameObject*>(), std::declval<T&>()...))*);
+            template<typename F>
+            static std::false_type Test(...);
+            using Type = decltype(Test<Function>(0));
+        };
+        
+        template<typename Function>
+        void ForEach(Function& function, std::true_type) {
+            ForEach(function, std::index_sequence_for<T...>());
+        }
+        
+        template<typename Function>
+        void ForEach(Function& function, std::false_type) {
+            auto withObject = [&function] (GameObject*, T&... components) {
+                function(components...);
+            };
+            ForEach(withObject, std::index_sequence_for<T...>());
+        }
+        
+        template<typename Function, std::size_t... I>
+        void ForEach(Function& function, std::index_sequence<I...>);
+        
+        template<typename Function>
+        void ParallelForEach(Function& function, int grainSize, Partition partition, std::true_type) {
+            ParallelForEach(function, grainSize, partition, std::index_sequence_for<T...>());
+        }
+        
+        template<typename Function>
+        void ParallelForEach(Function& function, int grainSize, Partition partition, std::false_type) {
+            auto withObject = [&function] (GameObject*, T&... components) {
+                function(components...);
+            };
+            ParallelForEach(withObject, grainSize, partition, std::index_sequence_for<T...>());
+        }
+        
+        template<typename Function, std::size_t... I>
+        void ParallelForEach(Function& function, int grainSize, Partition partition, std::index_sequence<I...>);
+        
+        template<typename Function>
+        void ForEachChanged(Function& function, std::true_type) {
+            ForEachChanged(function, std::index_sequence_for<T...>());
+        }
+        
+        template<typename Function>
+        void ForEachChanged(Function& function, std::false_type) {
+            auto withObject = [&function] (GameObject*, T&... components) {
+                function(components...);
+            };
+            ForEachChanged(withObject, std::index_sequence_for<T...>());
+        }
+        
+        template<typename Function, std::size_t... I>
+        void ForEachChanged(Function& function, std::index_sequence<I...>);
+        
         template<typename Last>
         void ExtractComponents(std::vector<int>& components) {
             ComponentID id = GameIDHelper::GetComponentID<Last>();
-            TryAddComponentContainer(id, [](){ return new Container<Last>(); });
+            TryAddComponentContainer(id, [](){ return new typename ComponentContainer<Last>::Type(); });
             components.push_back(id);
+            if (!std::is_const<Last>::value) {
+                writeMask[id] = true;
+            }
         }
         
         template<typename First, typename Second, typename ...Rest>
@@ -7,62 +7,328 @@
 //
 
 #include "GameWorld.hpp"
+#include <algorithm>
+#include <chrono>
+#include <functional>
 #include <iostream>
 
 using namespace Pocket;
 
 GameWorld::GameWorld() {
-    for(int i=0; i<MaxComponents; ++i) {
-        components[i] = 0;
-    }
+    changeVersion = 1;
     root.world = this;
     objectCount = 0;
+    storageMode = StorageMode::Containers;
+    systemGraphDirty = true;
+    updateDt = 0;
+    objectBatchCount = 0;
+    depthFirstDirty = false;
+    backgroundTeardown = false;
+    defragmentSeconds = 0;
+    defragmentBytes = 0;
+    defragmentCursor = 0;
+    defragmentTrim = -1;
 }
 
 GameWorld::~GameWorld() {
     Clear();
+    WaitForTeardown();
     for(auto s : systems) {
         delete s;
     }
-    for(int i=0; i<MaxComponents; ++i) {
-        delete components[i];
+    for(auto id : componentTypes) {
+        delete components[id];
     }
 }
 
 const GameObject* GameWorld::Root() { return &root; }
 
+PropertyBatch& GameWorld::Properties() { return propertyBatch; }
+
 GameObject* GameWorld::CreateObject() {
+    if (Recording().world == this) {
+        CommandRecorder& recorder = CurrentRecorder();
+        recorder.placeholders.emplace_back();
+        Placeholder* placeholder = &recorder.placeholders.back();
+        placeholder->world = this;
+        placeholder->index = -3;
+        placeholder->parent.SetWithoutNotify(0);
+        placeholder->enabled.SetWithoutNotify(true);
+        placeholder->parent.Changed.Bind([this, placeholder] () {
+            Record(RecordedCommand::Type::SetParent, placeholder, -1, placeholder->parent);
+        });
+        placeholder->enabled.Changed.Bind([this, placeholder] () {
+            Record(RecordedCommand::Type::SetEnabled, placeholder, placeholder->enabled ? 1 : 0);
+        });
+        Record(RecordedCommand::Type::CreateObject, placeholder);
+        return placeholder;
+    }
     int index;
     if (objectsFreeIndicies.empty()) {
-        index = (int)objects.size();
-        objects.resize(index + 1);
-        if (index>=objectComponents[0].size()) {
-            for(int i=0; i<MaxComponents; i++) {
-                objectComponents[i].resize(index + 32);
-            }
-        }
+        index = AddSlot();
     } else {
         index = objectsFreeIndicies.back();
         objectsFreeIndicies.pop_back();
     }
     
-    for(int i=0; i<MaxComponents; i++) {
-        objectComponents[i][index] = -1;
-    }
     ++objectCount;
     GameObject& object = objects[index];
     object.Parent() = &root;
     object.index = index;
-    object.world = this;
     return &object;
 }
 
+void GameWorld::RemoveObjects(const ObjectCollection& objects) {
+    if (Recording().world == this) {
+        for(auto object : objects) {
+            object->Remove();
+        }
+        return;
+    }
+    int batchIndex;
+    ObjectBatch& batch = AddBatch(batchIndex);
+    for(auto object : objects) {
+        if (object->index<0) continue;
+        batch.objects.push_back(object);
+        object->index = -1;
+        ++generations[object->slot];
+        objectProperties[object->slot].Parent = 0;
+        while (GameObject* child = Node(object).firstChild) {
+            child->Remove();
+        }
+    }
+    removeCommands.Push(Command::Type::RemoveBatch, 0, batchIndex);
+}
+
+void GameWorld::CreateObjects(const ComponentMask& mask, int count, ObjectCollection& created) {
+    int first = (int)created.size();
+    AllocateObjects(count, created);
+    for(int i=first; i<created.size(); ++i) {
+        AttachNew(created[i], &root);
+    }
+    
+    mask.Iterate([this, &created, first] (ComponentID id) {
+        IContainer* container = components[id];
+        ComponentIndex& indices = objectComponents[id];
+        for(int i=first; i<created.size(); ++i) {
+            indices.Set(created[i]->index, container->Create());
+        }
+    });
+    for(int i=first; i<created.size(); ++i) {
+        activeComponents[created[i]->slot] = mask;
+        SetArchetypeDirty(created[i]->index);
+    }
+    
+    if (!mask.Any()) return;
+    int batchIndex;
+    ObjectBatch& batch = AddBatch(batchIndex);
+    batch.mask = mask;
+    batch.objects.assign(created.begin() + first, created.end());
+    createCommands.Push(Command::Type::EnableBatch, 0, batchIndex);
+}
+
+void GameWorld::AddComponents(ComponentID id, const ObjectCollection& objects) {
+    createdIndices.clear();
+    int batchIndex;
+    ObjectBatch& batch = AddBatch(batchIndex);
+    for(auto object : objects) {
+        if (object->index<0 || activeComponents[object->slot][id]) continue;
+        batch.objects.push_back(object);
+    }
+    if (batch.objects.empty()) return;
+    createdIndices.resize(batch.objects.size());
+    components[id]->CreateMany((int)createdIndices.size(), createdIndices.data());
+    ComponentIndex& indices = objectComponents[id];
+    for(int i=0; i<batch.objects.size(); ++i) {
+        GameObject* object = batch.objects[i];
+        indices.Set(object->index, createdIndices[i]);
+        activeComponents[object->slot][id] = true;
+        SetArchetypeDirty(object->index);
+    }
+    createCommands.Push(Command::Type::EnableComponents, 0, batchIndex, id);
+}
+
+void GameWorld::RemoveComponents(ComponentID id, const ObjectCollection& objects) {
+    if (Recording().world == this) {
+        for(auto object : objects) {
+            object->RemoveComponent(id);
+        }
+        return;
+    }
+    int batchIndex;
+    ObjectBatch& batch = AddBatch(batchIndex);
+    for(auto object : objects) {
+        if (object->index<0 || !activeComponents[object->slot][id]) continue;
+        batch.objects.push_back(object);
+    }
+    if (batch.objects.empty()) return;
+    removeCommands.Push(Command::Type::RemoveComponents, 0, batchIndex, id);
+}
+
+Prefab* GameWorld::CreatePrefab(GameObject* source) {
+    prefabs.emplace_back(new Prefab(this));
+    Prefab& prefab = *prefabs.back();
+    CaptureNode(prefab, source, -1);
+    return &prefab;
+}
+
+void GameWorld::RemovePrefab(Prefab* prefab) {
+    for(auto& component : prefab->components) {
+        components[component.id]->Delete(component.index);
+    }
+    prefabs.erase(std::find_if(prefabs.begin(), prefabs.end(), [prefab] (const std::unique_ptr<Prefab>& p) {
+        return p.get() == prefab;
+    }));
+}
+
+void GameWorld::CaptureNode(Prefab& prefab, GameObject* object, int parent) {
+    int node = (int)prefab.nodes.size();
+    const ComponentMask& mask = activeComponents[object->slot];
+    prefab.nodes.push_back({ parent, object->Enabled(), mask, (int)prefab.components.size(), 0 });
+    mask.Iterate([this, &prefab, object] (ComponentID id) {
+        prefab.components.push_back({ id, components[id]->Clone(objectComponents[id][object->index]) });
+    });
+    prefab.nodes[node].componentCount = (int)prefab.components.size() - prefab.nodes[node].firstComponent;
+    for(GameObject* child = Node(object).firstChild; child; child = Node(child).next) {
+        CaptureNode(prefab, child, node);
+    }
+}
+
+// instances are laid out instance by instance, ie. node n of instance i is at first + i * nodeCount + n
+void GameWorld::Instantiate(Prefab& prefab, int count, ObjectCollection& roots, GameObject* parent) {
+    assert(Recording().world != this);
+    if (!parent) {
+        parent = &root;
+    }
+    int nodeCount = (int)prefab.nodes.size();
+    ObjectCollection& created = instantiatedObjects;
+    created.clear();
+    AllocateObjects(count * nodeCount, created);
+    roots.reserve(roots.size() + count);
+    
+    for(int i=0; i<count; ++i) {
+        GameObject** instance = &created[i * nodeCount];
+        for(int n=0; n<nodeCount; ++n) {
+            const Prefab::Node& node = prefab.nodes[n];
+            objectProperties[instance[n]->slot].Enabled.SetWithoutNotify(node.enabled);
+            AttachNew(instance[n], node.parent<0 ? parent : instance[node.parent]);
+        }
+        roots.push_back(instance[0]);
+    }
+    
+    for(int n=0; n<nodeCount; ++n) {
+        const Prefab::Node& node = prefab.nodes[n];
+        for(int c=node.firstComponent; c<node.firstComponent + node.componentCount; ++c) {
+            const Prefab::Component& component = prefab.components[c];
+            IContainer* container = components[component.id];
+            ComponentIndex& indices = objectComponents[component.id];
+            bool shared = prefab.shared[component.id];
+            for(int i=0; i<count; ++i) {
+                int index;
+                if (shared) {
+                    container->Reference(component.index);
+                    index = component.index;
+                    SetCopyOnWrite(component.id, created[i * nodeCount + n]->index, true);
+                } else {
+                    index = container->Clone(component.index);
+                }
+                indices.Set(created[i * nodeCount + n]->index, index);
+            }
+        }
+        if (!node.mask.Any()) continue;
+        int batchIndex;
+        ObjectBatch& batch = AddBatch(batchIndex);
+        batch.mask = node.mask;
+        for(int i=0; i<count; ++i) {
+            GameObject* object = created[i * nodeCount + n];
+            activeComponents[object->slot] = node.mask;
+            SetArchetypeDirty(object->index);
+            batch.objects.push_back(object);
+        }
+        createCommands.Push(Command::Type::EnableBatch, 0, batchIndex);
+    }
+}
+
+void GameWorld::AllocateObjects(int count, ObjectCollection& created) {
+    int reused = std::min(count, (int)objectsFreeIndicies.size());
+    ReserveSlots((int)objects.size() + count - reused);
+    created.reserve(created.size() + count);
+    for(int i=0; i<count; ++i) {
+        int index;
+        if (i<reused) {
+            index = objectsFreeIndicies.back();
+            objectsFreeIndicies.pop_back();
+        } else {
+            index = AddSlot();
+        }
+        GameObject* object = &objects[index];
+        object->index = index;
+        created.push_back(object);
+    }
+    objectCount += count;
+}
+
+// a new object has no parent and no children, so it can be attached without ParentChanged
+void GameWorld::AttachNew(GameObject* object, GameObject* parent) {
+    ObjectProperties& properties = objectProperties[object->slot];
+    properties.Parent.SetWithoutNotify(parent);
+    properties.WorldEnabled.MakeDirty();
+    Link(object, parent);
+}
+
+int GameWorld::AddSlot() {
+    int index = (int)objects.size();
+    objects.resize(index + 1);
+    if (index>=activeComponents.size()) {
+        ReserveSlots(index + 32);
+    }
+    objectProperties.emplace_back();
+    GameObject& object = objects[index];
+    object.slot = index;
+    object.world = this;
+    object.BindProperties();
+    return index;
+}
+
+void GameWorld::ReserveSlots(int size) {
+    if (size>activeComponents.size()) {
+        activeComponents.resize(size);
+        enabledComponents.resize(size);
+        objectChildren.resize(size);
+        hierarchy.resize(size);
+        archetypeLocations.resize(size);
+        archetypeDirty.resize(size, false);
+        looseObjectIndices.resize(size, -1);
+        for(auto id : componentTypes) {
+            if (changeTrackingCount[id]>0) {
+                changeVersions[id].resize(size, 0);
+            }
+        }
+    }
+    if (size>generations.size()) {
+        generations.resize(size, 0);
+    }
+}
+
 void GameWorld::Update(float dt) {
-    for(auto system : systems) {
-        system->Update(dt);
+    if (threadPool.WorkerCount()>0) {
+        UpdateSystemsParallel(dt);
+    } else {
+        for(auto system : systems) {
+            system->Update(dt);
+        }
+    }
+    propertyBatch.Flush();
+    DoCommands(createCommands);
+    DoCommands(removeCommands);
+    // batches may still be referenced by commands recorded while replaying, eg. from ObjectRemoved
+    if (createCommands.Empty() && removeCommands.Empty()) {
+        objectBatchCount = 0;
+    }
+    SyncArchetypes();
+    if (defragmentSeconds>0 || defragmentBytes>0) {
+        Defragment(defragmentSeconds, defragmentBytes);
     }
-    DoActions(createActions);
-    DoActions(removeActions);
 }
 
 void GameWorld::Render() {
@@ -71,6 +337,14 @@ void GameWorld::Render() {
     }
 }
 
+GameObject* GameWorld::Resolve(GameObjectHandle handle) {
+    return IsValid(handle) ? &objects[handle.slot] : 0;
+}
+
+bool GameWorld::IsValid(GameObjectHandle handle) const {
+    return handle.slot < objects.size() && generations[handle.slot] == handle.generation;
+}
+
 int GameWorld::ObjectCount() const {
     return objectCount;
 }
@@ -79,47 +353,370 @@ int GameWorld::CapacityCount() const {
     return (int)objects.size();
 }
 
-void GameWorld::Clear() {
-    IterateObjects([](GameObject* o) {
-        o->SetEnabled(false);
-    });
+void GameWorld::SetStorageMode(StorageMode mode) {
+    assert(objectCount == 0);
+    storageMode = mode;
+}
+
+StorageMode GameWorld::GetStorageMode() const {
+    return storageMode;
+}
+
+void GameWorld::SetWorkerCount(int count) {
+    threadPool.SetWorkerCount(count);
+    while (recorders.size()<=count) {
+        recorders.emplace_back(new CommandRecorder());
+    }
+}
+
+int GameWorld::WorkerCount() const {
+    return threadPool.WorkerCount();
+}
 
+void GameWorld::BuildSystemGraph() {
+    int count = (int)systems.size();
+    systemDependents.assign(count, std::vector<int>());
+    systemDependencies.assign(count, 0);
+    pendingDependencies.reset(new std::atomic<int>[count]);
+    for(int i=0; i<count; ++i) {
+        IGameSystem* system = systems[i];
+        for(int j=0; j<i; ++j) {
+            IGameSystem* earlier = systems[j];
+            bool conflict = system->writeMask.Intersects(earlier->componentMask) ||
+                            earlier->writeMask.Intersects(system->componentMask);
+            if (conflict) {
+                systemDependents[j].push_back(i);
+                ++systemDependencies[i];
+            }
+        }
+    }
+    systemGraphDirty = false;
+}
+
+void GameWorld::UpdateSystemsParallel(float dt) {
+    if (systemGraphDirty) {
+        BuildSystemGraph();
+    }
+    updateDt = dt;
+    for(int i=0; i<systems.size(); ++i) {
+        pendingDependencies[i] = systemDependencies[i];
+    }
+    for(int i=0; i<systems.size(); ++i) {
+        if (systemDependencies[i] == 0) {
+            threadPool.Run(systemsGroup, &GameWorld::UpdateSystemTask, this, i);
+        }
+    }
+    threadPool.Wait(systemsGroup);
+    ReplayRecorded();
+}
+
+void GameWorld::UpdateSystemTask(void* data, int index) {
+    GameWorld* world = static_cast<GameWorld*>(data);
+    RecordingContext& context = Recording();
+    RecordingContext previous = context;
+    context = { world, index, 0, -1, 0 };
+    world->systems[index]->Update(world->updateDt);
+    context = previous;
+    for(auto dependent : world->systemDependents[index]) {
+        if (--world->pendingDependencies[dependent] == 0) {
+            world->threadPool.Run(world->systemsGroup, &GameWorld::UpdateSystemTask, world, dependent);
+        }
+    }
+}
+
+GameWorld::RecordingContext& GameWorld::Recording() {
+    static thread_local RecordingContext context { 0, -1, 0, -1, 0 };
+    return context;
+}
+
+RecordedCommand* GameWorld::Record(RecordedCommand::Type type, GameObject* object, ComponentID component, GameObject* source, StagedComponent* value) {
+    RecordingContext& context = Recording();
+    if (context.world != this) return 0;
+    CommandRecorder& recorder = CurrentRecorder();
+    if (value) {
+        recorder.values.emplace_back(value);
+    }
+    recorder.commands.push_back({ type, component, object, source, value, context.system, context.step, context.item, context.sequence++ });
+    return &recorder.commands.back();
+}
+
+CommandRecorder& GameWorld::CurrentRecorder() {
+    int thread = threadPool.ThreadIndex();
+    // without workers there is only one thread, so recorders can be created here
+    while (recorders.size()<=thread) {
+        recorders.emplace_back(new CommandRecorder());
+    }
+    return *recorders[thread];
+}
+
+void GameWorld::ReplayRecorded() {
+    recordedCommands.clear();
+    for(auto& recorder : recorders) {
+        recordedCommands.insert(recordedCommands.end(), recorder->commands.begin(), recorder->commands.end());
+    }
+    std::sort(recordedCommands.begin(), recordedCommands.end());
+    
+    createdObjects.clear();
+    for(auto& command : recordedCommands) {
+        if (command.type == RecordedCommand::Type::CreateObject) {
+            command.object->index = -4 - (int)createdObjects.size();
+            createdObjects.push_back(CreateObject());
+            continue;
+        }
+        GameObject* object = ResolvePlaceholder(command.object);
+        switch (command.type) {
+            case RecordedCommand::Type::AddComponent:
+                command.value->AddTo(object);
+                break;
+            case RecordedCommand::Type::ReferenceComponent:
+                object->AddComponent(command.component, ResolvePlaceholder(command.source));
+                break;
+            case RecordedCommand::Type::CloneComponent:
+                object->CloneComponent(command.component, ResolvePlaceholder(command.source));
+                break;
+            case RecordedCommand::Type::ShareComponent:
+                object->ShareComponent(command.component, ResolvePlaceholder(command.source));
+                break;
+            case RecordedCommand::Type::RemoveComponent:
+                object->RemoveComponent(command.component);
+                break;
+            case RecordedCommand::Type::RemoveObject:
+                object->Remove();
+                break;
+            case RecordedCommand::Type::SetParent:
+                object->Parent() = command.source ? ResolvePlaceholder(command.source) : 0;
+                break;
+            case RecordedCommand::Type::SetEnabled:
+                object->Enabled() = command.component != 0;
+                break;
+            default:
+                break;
+        }
+    }
+    
+    for(auto& recorder : recorders) {
+        recorder->Clear();
+    }
+}
+
+// placeholders are given the index -4 - n when the n'th recorded object is created
+GameObject* GameWorld::ResolvePlaceholder(GameObject* object) const {
+    return object->index <= -4 ? createdObjects[-4 - object->index] : object;
+}
+
+// pending notifications are delivered first, so every system is told about the objects it had
+void GameWorld::Clear() {
+    CompactSystems();
+    NotifySystems();
+    for(auto system : systems) {
+        system->ClearObjects();
+    }
+    createCommands.Clear();
+    removeCommands.Clear();
+    objectBatchCount = 0;
+    propertyBatch.Clear();
+    prefabs.clear();
+    
+    // every slot steps its generation, so no handle from before is valid
+    for(auto& generation : generations) {
+        ++generation;
+    }
+    if (backgroundTeardown) {
+        StartTeardown();
+    }
     objects.clear();
     objectsFreeIndicies.clear();
     objectCount = 0;
-    for(int i=0; i<MaxComponents; ++i) {
-        if (components[i]) {
-            components[i]->Clear();
+    activeComponents.clear();
+    enabledComponents.clear();
+    objectChildren.clear();
+    rootChildren.clear();
+    hierarchy.clear();
+    rootNode = HierarchyNode();
+    depthFirst.clear();
+    depthFirstDirty = false;
+    objectProperties.clear();
+    for(auto id : componentTypes) {
+        components[id]->Clear();
+        objectComponents[id].Clear();
+        copyOnWrite[id].clear();
+        copyOnWriteCount[id] = 0;
+        changeVersions[id].clear();
+    }
+    archetypes.clear();
+    archetypeIndices.clear();
+    archetypeLocations.clear();
+    archetypeDirty.clear();
+    archetypeDirtyObjects.clear();
+    sharedRows.clear();
+    looseObjects.clear();
+    looseObjectIndices.clear();
+    defragmentCursor = 0;
+    defragmentTrim = -1;
+}
+
+void GameWorld::SetBackgroundTeardown(bool background) {
+    backgroundTeardown = background;
+}
+
+// the rest of Clear then only clears empty storage
+void GameWorld::StartTeardown() {
+    WaitForTeardown();
+    Teardown* teardown = new Teardown();
+    teardown->objects.swap(objects);
+    teardown->objectProperties.swap(objectProperties);
+    teardown->activeComponents.swap(activeComponents);
+    teardown->enabledComponents.swap(enabledComponents);
+    teardown->objectChildren.swap(objectChildren);
+    teardown->hierarchy.swap(hierarchy);
+    teardown->archetypes.swap(archetypes);
+    teardown->archetypeLocations.swap(archetypeLocations);
+    teardown->objectComponents.resize(componentTypes.size());
+    for(int i=0; i<componentTypes.size(); ++i) {
+        ComponentID id = componentTypes[i];
+        teardown->objectComponents[i].Swap(objectComponents[id]);
+        IContainer* released = components[id]->Release();
+        if (released) {
+            teardown->containers.emplace_back(released);
         }
-        objectComponents[i].clear();
+    }
+    teardownThread = std::thread([teardown] () {
+        delete teardown;
+    });
+}
+
+void GameWorld::WaitForTeardown() {
+    if (teardownThread.joinable()) {
+        teardownThread.join();
     }
 }
 
 void GameWorld::Trim() {
-    for(int i=0; i<MaxComponents; ++i) {
-        if (components[i]) {
-            components[i]->Trim();
-        }
+    for(auto id : componentTypes) {
+        components[id]->Trim();
     }
-    
-    int smallestSize = 0;
+    int size = UsedSlots();
+    for(auto id : componentTypes) {
+        objectComponents[id].Trim(size);
+    }
+    TrimObjects(size);
+}
+
+// slots up to the last one with an object, including objects being removed
+int GameWorld::UsedSlots() const {
     for(int i = (int)objects.size() - 1; i>=0; --i) {
         if (objects[i].index>=-1) {
-            smallestSize = i + 1;
-            break;
+            return i + 1;
         }
     }
-    if (smallestSize<objects.size()) {
-        for(int i=0; i<MaxComponents; ++i) {
-            objectComponents[i].resize(smallestSize);
+    return 0;
+}
+
+void GameWorld::TrimObjects(int size) {
+    if (size>=objects.size()) return;
+    activeComponents.resize(size);
+    enabledComponents.resize(size);
+    objectChildren.resize(size);
+    hierarchy.resize(size);
+    archetypeLocations.resize(size);
+    archetypeDirty.resize(size);
+    looseObjectIndices.resize(size);
+    objectProperties.resize(size);
+    objects.resize(size);
+    objectsFreeIndicies.erase(std::remove_if(objectsFreeIndicies.begin(), objectsFreeIndicies.end(), [size] (int index) {
+        return index >= size;
+    }), objectsFreeIndicies.end());
+}
+
+void GameWorld::SetDefragmentBudget(double seconds, std::size_t bytes) {
+    defragmentSeconds = seconds;
+    defragmentBytes = bytes;
+}
+
+// Objects are visited a few at a time between checks of the budget, and containers are trimmed one at a time.
+// A step always does some work, so defragmenting moves on however small the budget is
+bool GameWorld::Defragment(double seconds, std::size_t bytes) {
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start = Clock::now();
+    std::size_t moved = 0;
+    auto exhausted = [&] () {
+        return (bytes>0 && moved>=bytes) ||
+               (seconds>0 && std::chrono::duration<double>(Clock::now() - start).count()>=seconds);
+    };
+    // the batch may point at properties in the components moved below, eg. set by ObjectAdded in Update
+    propertyBatch.Flush();
+    
+    while (defragmentTrim<0) {
+        int end = std::min((int)objects.size(), defragmentCursor + 64);
+        for(; defragmentCursor<end; ++defragmentCursor) {
+            GameObject& object = objects[defragmentCursor];
+            if (object.index<0) continue;
+            activeComponents[object.slot].Iterate([this, &object, &moved] (ComponentID id) {
+                IContainer* container = components[id];
+                int from = objectComponents[id][object.index];
+                // shared entries are also referenced by other objects or prefabs, and stay where they are
+                if (container->ReferenceCount(from)!=1) return;
+                int to = container->Compact(from);
+                if (to == from) return;
+                objectComponents[id].Set(object.index, to);
+                moved += container->EntrySize();
+            });
         }
-        objects.resize(smallestSize);
-        for(int i=0; i<objectsFreeIndicies.size(); ++i) {
-            if (objectsFreeIndicies[i]>=smallestSize) {
-                objectsFreeIndicies.erase(objectsFreeIndicies.begin() + i);
-                --i;
+        if (defragmentCursor>=objects.size()) {
+            for(auto& prefab : prefabs) {
+                for(auto& component : prefab->components) {
+                    IContainer* container = components[component.id];
+                    if (container->ReferenceCount(component.index)!=1) continue;
+                    int to = container->Compact(component.index);
+                    if (to == component.index) continue;
+                    component.index = to;
+                    moved += container->EntrySize();
+                }
             }
+            // slots are reused from the lowest, so the ones at the end empty out
+            std::sort(objectsFreeIndicies.begin(), objectsFreeIndicies.end(), std::greater<int>());
+            defragmentTrim = 0;
         }
+        if (exhausted()) return false;
+    }
+    
+    while (defragmentTrim<componentTypes.size()) {
+        ComponentID id = componentTypes[defragmentTrim++];
+        components[id]->Trim();
+        objectComponents[id].Trim(UsedSlots());
+        if (exhausted()) return false;
+    }
+    TrimObjects(UsedSlots());
+    defragmentCursor = 0;
+    defragmentTrim = -1;
+    return true;
+}
+
+GameWorld::Fragmentation GameWorld::GetFragmentation() const {
+    Fragmentation fragmentation;
+    fragmentation.freeComponents = 0;
+    fragmentation.freeBytes = 0;
+    fragmentation.freeObjects = (int)objectsFreeIndicies.size();
+    for(auto id : componentTypes) {
+        int free = components[id]->FreeCount();
+        fragmentation.freeComponents += free;
+        fragmentation.freeBytes += (std::size_t)free * components[id]->EntrySize();
+    }
+    return fragmentation;
+}
+
+void GameWorld::TryAddComponentContainer(ComponentID id, std::function<IContainer*()> constructor) {
+    if (id>=components.size()) {
+        components.resize(id + 1, 0);
+        objectComponents.resize(id + 1);
+        copyOnWrite.resize(id + 1);
+        copyOnWriteCount.resize(id + 1, 0);
+        changeVersions.resize(id + 1);
+        changeTrackingCount.resize(id + 1, 0);
+    }
+    if (!components[id]) {
+        components[id] = constructor();
+        componentTypes.push_back(id);
     }
 }
 
@@ -140,14 +737,15 @@ IGameSystem* GameWorld::TryAddSystem(SystemID id, std::function<IGameSystem *(st
         }
         systemsIndexed[id] = system;
         systems.push_back(system);
+        systemGraphDirty = true;
         system->Initialize();
         
-        IterateObjects([system](GameObject* o) {
-            if ((o->data->enabledComponents & system->componentMask) == system->componentMask) {
-                system->objects.push_back(o);
-                system->ObjectAdded(o);
+        IterateObjects([this, system](GameObject* o) {
+            if (enabledComponents[o->slot].Contains(system->componentMask)) {
+                system->NotifyAdded(o);
             }
         });
+        system->FlushNotifications();
     }
     return system;
 }
@@ -157,32 +755,439 @@ void GameWorld::TryRemoveSystem(SystemID id) {
     IGameSystem* system = systemsIndexed[id];
     if (!system) return;
     
-    IterateObjects([system](GameObject* o) {
-        if ((o->data->enabledComponents & system->componentMask) == system->componentMask) {
-            system->ObjectRemoved(o);
-            auto& objects = system->objects;
-            objects.erase(std::find(objects.begin(), objects.end(), o));
+    IterateObjects([this, system](GameObject* o) {
+        if (enabledComponents[o->slot].Contains(system->componentMask)) {
+            system->NotifyRemoved(o);
         }
     });
+    system->FlushNotifications();
 
     
-    for(int i=0; i<MaxComponents; ++i) {
-        if (system->componentMask[i]) {
-            auto& list = systemsPerComponent[i];
-            list.erase(std::find(list.begin(), list.end(), system));
-        }
-    }
+    system->componentMask.Iterate([this, system] (ComponentID id) {
+        auto& list = systemsPerComponent[id];
+        list.erase(std::find(list.begin(), list.end(), system));
+    });
     
+    systemsToCompact.erase(std::remove(systemsToCompact.begin(), systemsToCompact.end(), system), systemsToCompact.end());
+    std::replace(systemsToNotify.begin(), systemsToNotify.end(), system, (IGameSystem*)0);
     systems.erase(std::find(systems.begin(), systems.end(), system));
     systemsIndexed[id] = 0;
+    systemGraphDirty = true;
+    if (system->trackChanges) {
+        TrackChanges(system->componentMask, -1);
+    }
     delete system;
 }
 
-void GameWorld::DoActions(Actions &actions) {
-    for(auto action : actions) {
-        action();
+void GameWorld::DoCommands(CommandBuffer& commands) {
+    // commands recorded while replaying are appended, and replayed in the same pass,
+    // including commands recorded by batched notifications
+    int i = 0;
+    do {
+        for(; i<commands.Size(); ++i) {
+            const Command command = commands[i];
+            GameObject* object = command.object;
+            switch (command.type) {
+                case Command::Type::EnableComponent:
+                    object->TrySetComponentEnabled(command.component, true);
+                    break;
+                case Command::Type::RemoveComponent:
+                    object->CommitRemoveComponent(command.component, command.index);
+                    break;
+                case Command::Type::RemoveObject:
+                    object->CommitRemove(command.index);
+                    break;
+                case Command::Type::UpdateEnabled:
+                    UpdateEnabled(object);
+                    break;
+                case Command::Type::EnableBatch:
+                    EnableBatch(command.index);
+                    break;
+                case Command::Type::RemoveBatch:
+                    CommitRemoveBatch(command.index);
+                    break;
+                case Command::Type::EnableComponents:
+                    EnableComponents(command.index, command.component);
+                    break;
+                case Command::Type::RemoveComponents:
+                    CommitRemoveComponents(command.index, command.component);
+                    break;
+            }
+        }
+        CompactSystems();
+        NotifySystems();
+    } while (i<commands.Size());
+    commands.Clear();
+}
+
+GameWorld::ObjectBatch& GameWorld::AddBatch(int& index) {
+    index = objectBatchCount++;
+    if (index>=objectBatches.size()) {
+        objectBatches.emplace_back();
+    }
+    ObjectBatch& batch = objectBatches[index];
+    batch.mask.Reset();
+    batch.objects.clear();
+    return batch;
+}
+
+// objects of a batch all start out with the batch's components and nothing enabled,
+// so the systems interested in them are the same, and found once
+void GameWorld::EnableBatch(int batchIndex) {
+    FindSystems(objectBatches[batchIndex].mask, matchingSystems);
+    // reading the batch by index, since ObjectAdded may create batches
+    for(int i=0; i<objectBatches[batchIndex].objects.size(); ++i) {
+        const ObjectBatch& batch = objectBatches[batchIndex];
+        GameObject* object = batch.objects[i];
+        if (object->index<0) continue;
+        ComponentMask& enabled = enabledComponents[object->slot];
+        if (enabled.Any() || !activeComponents[object->slot].Contains(batch.mask) || !object->WorldEnabled()) {
+            // changed since it was created, enable one component at a time
+            ComponentMask mask = batch.mask & activeComponents[object->slot];
+            mask.Iterate([object] (ComponentID id) {
+                object->TrySetComponentEnabled(id, true);
+            });
+            continue;
+        }
+        enabled = batch.mask;
+        batch.mask.Iterate([this, object] (ComponentID id) {
+            MarkChanged(id, object->slot);
+        });
+        SetArchetypeDirty(object->index);
+        for(auto system : matchingSystems) {
+            system->NotifyAdded(object);
+        }
+    }
+}
+
+// an object is in every system whose components are all enabled on it,
+// so systems are found once per distinct set of enabled components
+void GameWorld::CommitRemoveBatch(int batchIndex) {
+    ComponentMask matchingMask;
+    matchingSystems.clear();
+    for(int i=0; i<objectBatches[batchIndex].objects.size(); ++i) {
+        GameObject* object = objectBatches[batchIndex].objects[i];
+        ComponentMask& enabled = enabledComponents[object->slot];
+        if (enabled != matchingMask) {
+            matchingMask = enabled;
+            FindSystems(matchingMask, matchingSystems);
+        }
+        for(auto system : matchingSystems) {
+            system->NotifyRemoved(object);
+        }
+        enabled.Reset();
+        object->CommitRemove(object->slot);
+    }
+}
+
+void GameWorld::Link(GameObject* object, GameObject* parent) {
+    HierarchyNode& parentNode = Node(parent);
+    HierarchyNode& node = Node(object);
+    node.previous = parentNode.lastChild;
+    node.next = nullptr;
+    if (parentNode.lastChild) {
+        Node(parentNode.lastChild).next = object;
+    } else {
+        parentNode.firstChild = object;
+    }
+    parentNode.lastChild = object;
+    parentNode.childrenDirty = true;
+    depthFirstDirty = true;
+}
+
+void GameWorld::Unlink(GameObject* object, GameObject* parent) {
+    HierarchyNode& parentNode = Node(parent);
+    HierarchyNode& node = Node(object);
+    if (node.previous) {
+        Node(node.previous).next = node.next;
+    } else {
+        parentNode.firstChild = node.next;
+    }
+    if (node.next) {
+        Node(node.next).previous = node.previous;
+    } else {
+        parentNode.lastChild = node.previous;
+    }
+    node.previous = node.next = nullptr;
+    parentNode.childrenDirty = true;
+    depthFirstDirty = true;
+}
+
+const ObjectCollection& GameWorld::Children(const GameObject* object) {
+    HierarchyNode& node = Node(object);
+    ObjectCollection& children = object == &root ? rootChildren : objectChildren[object->slot];
+    if (node.childrenDirty) {
+        node.childrenDirty = false;
+        children.clear();
+        for(GameObject* child = node.firstChild; child; child = Node(child).next) {
+            children.push_back(child);
+        }
+    }
+    return children;
+}
+
+ObjectRange GameWorld::Descendants(const GameObject* object) {
+    const ObjectCollection& order = DepthFirst();
+    if (object == &root) {
+        return { order.data(), order.data() + order.size() };
+    }
+    const HierarchyNode& node = hierarchy[object->slot];
+    if (object->index<0) {
+        return { order.data(), order.data() };
+    }
+    GameObject* const* first = order.data() + node.depthFirstIndex + 1;
+    return { first, first + node.descendantCount };
+}
+
+// walks the links without a stack: down to the first child, else on to the next sibling,
+// else back up, where a parent's descendants are counted once all of them are placed
+const ObjectCollection& GameWorld::DepthFirst() {
+    if (!depthFirstDirty) return depthFirst;
+    depthFirstDirty = false;
+    depthFirst.clear();
+    GameObject* current = rootNode.firstChild;
+    while (current) {
+        HierarchyNode& node = hierarchy[current->slot];
+        node.depthFirstIndex = (int)depthFirst.size();
+        depthFirst.push_back(current);
+        if (node.firstChild) {
+            current = node.firstChild;
+            continue;
+        }
+        while (current) {
+            HierarchyNode& leaving = hierarchy[current->slot];
+            leaving.descendantCount = (int)depthFirst.size() - leaving.depthFirstIndex - 1;
+            if (leaving.next) {
+                current = leaving.next;
+                break;
+            }
+            GameObject* parent = objectProperties[current->slot].Parent;
+            current = parent == &root ? nullptr : parent;
+        }
+    }
+    return depthFirst;
+}
+
+// The depth first order is rebuilt at most once per replay of commands, as UpdateEnabled asks for it.
+// Changes made between replays walk the links instead, since each reparent would need a rebuild
+void GameWorld::GatherSubtree(GameObject* object, bool rebuild, ObjectCollection& subtree) {
+    subtree.clear();
+    subtree.push_back(object);
+    if (object->index>=0 && (rebuild || !depthFirstDirty)) {
+        ObjectRange descendants = Descendants(object);
+        subtree.insert(subtree.end(), descendants.begin(), descendants.end());
+        return;
+    }
+    for(int i=0; i<subtree.size(); ++i) {
+        for(GameObject* child = Node(subtree[i]).firstChild; child; child = Node(child).next) {
+            subtree.push_back(child);
+        }
+    }
+}
+
+// the subtree is gathered first, so it is free for changes made by HasBecomeDirty listeners
+void GameWorld::SetWorldEnabledDirty(GameObject* object) {
+    ObjectCollection subtree;
+    subtree.swap(hierarchyStack);
+    GatherSubtree(object, false, subtree);
+    for(auto current : subtree) {
+        objectProperties[current->slot].WorldEnabled.MakeDirty();
+    }
+    subtree.swap(hierarchyStack);
+}
+
+// Parents come before their children, so WorldEnabled of each object only reads its parent's cached value.
+// Objects going from none to all of their components enabled, or back, are added to or removed from
+// their systems directly, and the systems are found once per distinct set of components
+void GameWorld::UpdateEnabled(GameObject* root) {
+    ObjectCollection subtree;
+    subtree.swap(hierarchyObjects);
+    GatherSubtree(root, true, subtree);
+    
+    ComponentMask matchingMask;
+    bool found = false;
+    for(auto object : subtree) {
+        bool worldEnabled = object->WorldEnabled();
+        ComponentMask& enabled = enabledComponents[object->slot];
+        const ComponentMask& active = activeComponents[object->slot];
+        if (worldEnabled ? enabled == active : !enabled.Any()) continue;
+        if (worldEnabled && enabled.Any()) {
+            object->SetEnabled(true);
+            continue;
+        }
+        const ComponentMask& mask = worldEnabled ? active : enabled;
+        if (!found || mask != matchingMask) {
+            matchingMask = mask;
+            found = true;
+            FindSystems(matchingMask, matchingSystems);
+        }
+        if (object->index>=0) {
+            SetArchetypeDirty(object->index);
+        }
+        if (worldEnabled) {
+            enabled = active;
+            active.Iterate([this, object] (ComponentID id) {
+                MarkChanged(id, object->slot);
+            });
+            for(auto system : matchingSystems) {
+                system->NotifyAdded(object);
+            }
+        } else {
+            for(auto system : matchingSystems) {
+                system->NotifyRemoved(object);
+            }
+            enabled.Reset();
+        }
+    }
+    subtree.swap(hierarchyObjects);
+}
+
+// systems gaining an object are the systems using id whose components are all enabled once id is,
+// and they are the same for all objects with the same enabled components
+void GameWorld::EnableComponents(int batchIndex, ComponentID id) {
+    ComponentMask matchingMask;
+    bool found = false;
+    for(int i=0; i<objectBatches[batchIndex].objects.size(); ++i) {
+        GameObject* object = objectBatches[batchIndex].objects[i];
+        if (object->index<0 || !activeComponents[object->slot][id]) continue;
+        ComponentMask& enabled = enabledComponents[object->slot];
+        if (enabled[id] || !object->WorldEnabled()) continue;
+        if (!found || enabled != matchingMask) {
+            matchingMask = enabled;
+            found = true;
+            ComponentMask withComponent = enabled;
+            withComponent[id] = true;
+            FindSystemsWith(id, withComponent, matchingSystems);
+        }
+        enabled[id] = true;
+        MarkChanged(id, object->slot);
+        SetArchetypeDirty(object->index);
+        for(auto system : matchingSystems) {
+            system->NotifyAdded(object);
+        }
+    }
+}
+
+void GameWorld::CommitRemoveComponents(int batchIndex, ComponentID id) {
+    ComponentMask matchingMask;
+    bool found = false;
+    IContainer* container = components[id];
+    for(int i=0; i<objectBatches[batchIndex].objects.size(); ++i) {
+        GameObject* object = objectBatches[batchIndex].objects[i];
+        int slot = object->slot;
+        if (!activeComponents[slot][id]) continue;
+        ComponentMask& enabled = enabledComponents[slot];
+        if (enabled[id]) {
+            if (!found || enabled != matchingMask) {
+                matchingMask = enabled;
+                found = true;
+                FindSystemsWith(id, enabled, matchingSystems);
+            }
+            for(auto system : matchingSystems) {
+                system->NotifyRemoved(object);
+            }
+            enabled[id] = false;
+        }
+        container->Delete(objectComponents[id][slot]);
+        objectComponents[id].Set(slot, -1);
+        activeComponents[slot][id] = false;
+        SetCopyOnWrite(id, slot, false);
+        SetArchetypeDirty(slot);
+    }
+}
+
+void GameWorld::FindSystemsWith(ComponentID id, const ComponentMask& mask, Systems& result) const {
+    result.clear();
+    if (id>=systemsPerComponent.size()) return;
+    for(auto system : systemsPerComponent[id]) {
+        if (mask.Contains(system->componentMask)) {
+            result.push_back(system);
+        }
+    }
+}
+
+void GameWorld::FindSystems(const ComponentMask& mask, Systems& result) const {
+    result.clear();
+    for(auto system : systems) {
+        if (system->componentMask.Any() && mask.Contains(system->componentMask)) {
+            result.push_back(system);
+        }
+    }
+}
+
+bool GameWorld::IsCopyOnWrite(ComponentID id, int objectIndex) const {
+    const std::vector<bool>& flags = copyOnWrite[id];
+    return objectIndex<flags.size() && flags[objectIndex];
+}
+
+void GameWorld::SetCopyOnWrite(ComponentID id, int objectIndex, bool enable) {
+    std::vector<bool>& flags = copyOnWrite[id];
+    if (objectIndex>=flags.size()) {
+        if (!enable) return;
+        flags.resize(objectIndex + 1, false);
+    }
+    if (flags[objectIndex] == enable) return;
+    flags[objectIndex] = enable;
+    copyOnWriteCount[id] += enable ? 1 : -1;
+}
+
+// The last object sharing the component keeps it, rather than copying it.
+// Only state of component id is touched, since systems writing it may detach while other systems run on workers,
+// so archetype storage packs the copy the next time the object changes.
+int GameWorld::Detach(ComponentID id, int objectIndex) {
+    IContainer* container = components[id];
+    int index = objectComponents[id][objectIndex];
+    if (container->ReferenceCount(index)>1) {
+        int copy = container->Clone(index);
+        container->Delete(index);
+        objectComponents[id].Set(objectIndex, copy);
+        index = copy;
     }
-    actions.clear();
+    SetCopyOnWrite(id, objectIndex, false);
+    return index;
+}
+
+int GameWorld::TryDetach(ComponentID id, int objectIndex, int componentIndex) {
+    return IsCopyOnWrite(id, objectIndex) ? Detach(id, objectIndex) : componentIndex;
+}
+
+void GameWorld::DetachAll(ComponentID id, const ObjectCollection& objects) {
+    for(auto object : objects) {
+        if (IsCopyOnWrite(id, object->index)) {
+            Detach(id, object->index);
+        }
+    }
+}
+
+// tracking starts with every entry at the current version, so systems see all existing components as changed
+void GameWorld::TrackChanges(const ComponentMask& mask, int amount) {
+    mask.Iterate([this, amount] (ComponentID id) {
+        if (changeTrackingCount[id] == 0) {
+            changeVersions[id].assign(activeComponents.size(), changeVersion.load());
+        }
+        changeTrackingCount[id] += amount;
+        if (changeTrackingCount[id] == 0) {
+            changeVersions[id].clear();
+            changeVersions[id].shrink_to_fit();
+        }
+    });
+}
+
+void GameWorld::CompactSystems() {
+    for(auto system : systemsToCompact) {
+        system->CompactObjects();
+    }
+    systemsToCompact.clear();
+}
+
+// systems may be added or removed by notifications, and are flushed in the same pass
+void GameWorld::NotifySystems() {
+    for(int i=0; i<systemsToNotify.size(); ++i) {
+        if (systemsToNotify[i]) {
+            systemsToNotify[i]->FlushNotifications();
+        }
+    }
+    systemsToNotify.clear();
 }
 
 void GameWorld::IterateObjects(std::function<void (GameObject *)> callback) {
@@ -191,4 +1196,176 @@ void GameWorld::IterateObjects(std::function<void (GameObject *)> callback) {
             callback(&o);
         }
     }
+}
+
+void GameWorld::SetArchetypeDirty(int objectIndex) {
+    if (storageMode != StorageMode::Archetypes) return;
+    if (archetypeDirty[objectIndex]) return;
+    archetypeDirty[objectIndex] = true;
+    archetypeDirtyObjects.push_back(objectIndex);
+}
+
+void GameWorld::SyncArchetypes() {
+    if (storageMode != StorageMode::Archetypes) return;
+    DetachSharedRows();
+    
+    for(auto objectIndex : archetypeDirtyObjects) {
+        archetypeDirty[objectIndex] = false;
+        GameObject& object = objects[objectIndex];
+        
+        ComponentMask mask;
+        if (object.index>=0) {
+            activeComponents[objectIndex].Iterate([this, objectIndex, &mask] (ComponentID id) {
+                IContainer* container = components[id];
+                if (container->CanCreateBlocks() && container->ReferenceCount(objectComponents[id][objectIndex]) == 1) {
+                    mask[id] = true;
+                }
+            });
+        }
+        
+        ArchetypeLocation& location = archetypeLocations[objectIndex];
+        ComponentMask currentMask = location.archetype>=0 ? archetypes[location.archetype].mask : ComponentMask();
+        if (mask != currentMask) {
+            MoveToArchetype(objectIndex, mask);
+        }
+        if (location.archetype>=0) {
+            ArchetypeChunk& chunk = archetypes[location.archetype].chunks[location.chunk];
+            chunk.enabled[location.row] = enabledComponents[objectIndex].Contains(mask);
+        }
+        SetLoose(objectIndex, object.index>=0 && activeComponents[objectIndex].Intersects(~mask));
+    }
+    archetypeDirtyObjects.clear();
+}
+
+void GameWorld::DetachSharedRows() {
+    // components referenced by other objects cannot stay inside a chunk row,
+    // since the row is moved whenever its owner changes archetype
+    std::unordered_map<long long, int> detached;
+    for(auto& shared : sharedRows) {
+        long long key = ((long long)shared.id << 32) | shared.index;
+        int index;
+        auto it = detached.find(key);
+        if (it!=detached.end()) {
+            index = it->second;
+        } else {
+            IContainer* container = components[shared.id];
+            if (!container->IsBlock(shared.index) || container->ReferenceCount(shared.index) == 0) continue;
+            index = container->Move(shared.index);
+            detached[key] = index;
+        }
+        for(auto objectIndex : { shared.source, shared.object }) {
+            if (objectComponents[shared.id].Get(objectIndex) == shared.index) {
+                objectComponents[shared.id].Set(objectIndex, index);
+                SetArchetypeDirty(objectIndex);
+            }
+        }
+    }
+    sharedRows.clear();
+}
+
+void GameWorld::MoveToArchetype(int objectIndex, const ComponentMask& mask) {
+    ArchetypeLocation previous = archetypeLocations[objectIndex];
+    ArchetypeLocation& location = archetypeLocations[objectIndex];
+    location = ArchetypeLocation();
+    
+    if (mask.Any()) {
+        location.archetype = FindArchetype(mask);
+        Archetype& archetype = archetypes[location.archetype];
+        auto& openChunks = archetype.openChunks;
+        while (!openChunks.empty() && archetype.chunks[openChunks.back()].count == ContainerPageSize) {
+            openChunks.pop_back();
+        }
+        if (openChunks.empty()) {
+            openChunks.push_back((int)archetype.chunks.size());
+            archetype.chunks.emplace_back();
+        }
+        location.chunk = openChunks.back();
+        ArchetypeChunk& chunk = archetype.chunks[location.chunk];
+        if (chunk.blocks.empty()) {
+            for(auto id : archetype.components) {
+                chunk.blocks.push_back(components[id]->CreateBlock());
+            }
+            chunk.objects.resize(ContainerPageSize);
+            chunk.enabled.resize(ContainerPageSize);
+        }
+        location.row = chunk.count++;
+        chunk.objects[location.row] = objectIndex;
+        chunk.enabled[location.row] = false;
+        for(int i=0; i<archetype.components.size(); ++i) {
+            ComponentID id = archetype.components[i];
+            int index = chunk.blocks[i] + location.row;
+            components[id]->Move(objectComponents[id][objectIndex], index);
+            objectComponents[id].Set(objectIndex, index);
+        }
+    }
+    
+    if (previous.archetype<0) return;
+    
+    Archetype& archetype = archetypes[previous.archetype];
+    ArchetypeChunk& chunk = archetype.chunks[previous.chunk];
+    int last = chunk.count - 1;
+    for(int i=0; i<archetype.components.size(); ++i) {
+        ComponentID id = archetype.components[i];
+        IContainer* container = components[id];
+        int index = chunk.blocks[i] + previous.row;
+        if (objectComponents[id].Get(objectIndex) == index) {
+            // component is still used by the object, but no longer packed
+            objectComponents[id].Set(objectIndex, container->Move(index));
+        }
+        if (previous.row != last) {
+            int lastIndex = chunk.blocks[i] + last;
+            int lastObject = chunk.objects[last];
+            container->Move(lastIndex, index);
+            if (objectComponents[id].Get(lastObject) == lastIndex) {
+                objectComponents[id].Set(lastObject, index);
+            }
+        }
+    }
+    if (previous.row != last) {
+        int lastObject = chunk.objects[last];
+        chunk.objects[previous.row] = lastObject;
+        chunk.enabled[previous.row] = chunk.enabled[last];
+        archetypeLocations[lastObject].row = previous.row;
+    }
+    if (chunk.count == ContainerPageSize) {
+        archetype.openChunks.push_back(previous.chunk);
+    }
+    --chunk.count;
+    if (chunk.count == 0) {
+        for(int i=0; i<archetype.components.size(); ++i) {
+            components[archetype.components[i]]->DeleteBlock(chunk.blocks[i]);
+        }
+        chunk.blocks.clear();
+    }
+}
+
+int GameWorld::FindArchetype(const ComponentMask& mask) {
+    auto it = archetypeIndices.find(mask);
+    if (it!=archetypeIndices.end()) {
+        return it->second;
+    }
+    int index = (int)archetypes.size();
+    archetypes.emplace_back();
+    Archetype& archetype = archetypes.back();
+    archetype.mask = mask;
+    mask.Iterate([&archetype] (ComponentID id) {
+        archetype.components.push_back(id);
+    });
+    archetypeIndices[mask] = index;
+    return index;
+}
+
+void GameWorld::SetLoose(int objectIndex, bool loose) {
+    int& looseIndex = looseObjectIndices[objectIndex];
+    if (loose == (looseIndex>=0)) return;
+    if (loose) {
+        looseIndex = (int)looseObjects.size();
+        looseObjects.push_back(objectIndex);
+    } else {
+        int last = looseObjects.back();
+        looseObjects[looseIndex] = last;
+        looseObjectIndices[last] = looseIndex;
+        looseObjects.pop_back();
+        looseIndex = -1;
+    }
 }
\ No newline at end of file
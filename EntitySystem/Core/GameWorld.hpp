@@ -7,9 +7,22 @@
 //
 
 #pragma once
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <tuple>
+#include <utility>
 #include "GameObject.hpp"
 #include "Container.hpp"
+#include "PackedContainer.hpp"
 #include "GameSystem.hpp"
+#include "Archetype.hpp"
+#include "CommandBuffer.hpp"
+#include "ComponentIndex.hpp"
+#include "Prefab.hpp"
+#include "ThreadPool.hpp"
 
 namespace Pocket {
     class GameWorld {
@@ -21,6 +34,59 @@ namespace Pocket {
         
         GameObject* CreateObject();
         
+        // Creates count objects with the components T..., and appends them to objects.
+        // Slots and indices are reserved once for all of them, and when the components are enabled in Update,
+        // the systems interested in the objects are found once for the whole batch.
+        template<typename... T>
+        void CreateObjects(int count, ObjectCollection& objects) {
+            if (Recording().world == this) {
+                for(int i=0; i<count; ++i) {
+                    GameObject* object = CreateObject();
+                    int expand[] = { 0, (object->AddComponent<T>(), 0)... };
+                    (void)expand;
+                    objects.push_back(object);
+                }
+                return;
+            }
+            ComponentMask mask;
+            int expand[] = { 0, (mask[AddComponentType<T>()] = true, 0)... };
+            (void)expand;
+            CreateObjects(mask, count, objects);
+        }
+        
+        // Removes the objects like Remove, but takes them out of root's children in one pass,
+        // and systems are found once per distinct set of components when the removal is applied in Update.
+        void RemoveObjects(const ObjectCollection& objects);
+        
+        // Adds T with value to all the objects that don't have it, with the new components next to each other
+        // in the container. When enabled in Update, the systems interested in the objects are found once
+        // per distinct set of enabled components, rather than per object.
+        template<typename T>
+        void AddComponents(const ObjectCollection& objects, const T& value = T()) {
+            if (Recording().world == this) {
+                for(auto object : objects) {
+                    *object->AddComponent<T>() = value;
+                }
+                return;
+            }
+            ComponentID id = AddComponentType<T>();
+            AddComponents(id, objects);
+            auto container = static_cast<typename ComponentContainer<T>::Type*>(components[id]);
+            for(auto index : createdIndices) {
+                (*container)[index] = value;
+            }
+        }
+        
+        // removes T from all the objects, systems are found like for AddComponents
+        template<typename T>
+        void RemoveComponents(const ObjectCollection& objects) {
+            RemoveComponents(GameIDHelper::GetComponentID<T>(), objects);
+        }
+        
+        // captures source and its descendants, see Prefab
+        Prefab* CreatePrefab(GameObject* source);
+        void RemovePrefab(Prefab* prefab);
+        
         template<typename T>
         T* CreateSystem() {
             return static_cast<T*>(
@@ -45,12 +111,85 @@ namespace Pocket {
         void Update(float dt);
         void Render();
         
+        // Number of worker threads used by Update, 0 updates all systems on the calling thread.
+        // With workers, systems that don't write components used by the other run concurrently,
+        // systems that do run in creation order. Systems must not change objects or components
+        // of other systems while updating in parallel.
+        // CreateObject, AddComponent, CloneComponent, RemoveComponent and Remove called by systems
+        // on workers are recorded per thread, and made after all systems are done, in the order
+        // a single thread would have made them. Objects created on a worker are placeholders until then,
+        // without components, and setting their Parent or Enabled is recorded as well.
+        // Parent and Enabled of objects that already exist are shared with every system through the hierarchy,
+        // and must not be set by systems updating on workers.
+        void SetWorkerCount(int count);
+        int WorkerCount() const;
+        
+        // object of the handle, null if it has been removed
+        GameObject* Resolve(GameObjectHandle handle);
+        bool IsValid(GameObjectHandle handle) const;
+        
         int ObjectCount() const;
         int CapacityCount() const;
         
+        // Tells every system once that all its objects are gone, see IGameSystem::ObjectsCleared,
+        // and drops the objects and their components wholesale.
         void Clear();
         void Trim();
         
+        // With background teardown, Clear hands the storage of objects and components to a thread which
+        // destroys it, so Clear returns without waiting. Component destructors then run on that thread.
+        // The next Clear and the destructor wait for the thread to finish.
+        void SetBackgroundTeardown(bool background);
+        
+        // Moves components into unused entries before them in their containers, so the pages at the end
+        // empty out and are released, and object slots are reused from the lowest so the last ones can be released.
+        // Objects themselves never move. Works through the objects a part at a time, and returns true when
+        // a full pass is done. Stops once either budget is used, 0 is no limit of that kind.
+        // Flushes the property batch first. Component pointers are invalid after it has run.
+        // Components are moved by assignment, so Events in them, eg. Property::Changed, lose their bindings,
+        // and batched Properties their batch.
+        bool Defragment(double seconds, std::size_t bytes);
+        
+        // Budget for defragmenting at the end of every Update, 0 for both turns it off.
+        void SetDefragmentBudget(double seconds, std::size_t bytes);
+        
+        // unused component entries and object slots, what defragmenting can reclaim at most
+        struct Fragmentation {
+            int freeComponents;
+            std::size_t freeBytes;
+            int freeObjects;
+        };
+        Fragmentation GetFragmentation() const;
+        
+        // All objects of the hierarchy depth first, each object is followed by its descendants.
+        // Rebuilt when asked for after the hierarchy has changed.
+        const ObjectCollection& DepthFirst();
+        
+        // Batch for properties set by systems, eg. from workers. Update flushes it once the systems are done,
+        // before changes to objects are applied. Cleared by Clear, see Property::SetBatch.
+        PropertyBatch& Properties();
+        
+        // Archetype storage packs the components of objects with the same components into chunks,
+        // objects are moved between chunks when changes are applied in Update.
+        // Component pointers are therefore only valid until the next Update.
+        // Can only be changed while the world has no objects.
+        void SetStorageMode(StorageMode mode);
+        StorageMode GetStorageMode() const;
+        
+        // container holding all components of type T, null if no object or system has used T yet
+        template<typename T>
+        typename ComponentContainer<T>::Type* GetContainer() {
+            ComponentID id = GameIDHelper::GetComponentID<T>();
+            return id<components.size() ? static_cast<typename ComponentContainer<T>::Type*>(components[id]) : 0;
+        }
+        
+        // Calls function(count, T*...) once per archetype chunk containing all of T...,
+        // each pointer points to count contiguous components. Only valid in archetype storage.
+        template<typename... T, typename Function>
+        void IterateChunks(Function&& function) {
+            IterateChunks<T...>(function, std::index_sequence_for<T...>());
+        }
+        
     private:
     
         GameObject root;
@@ -59,45 +198,446 @@ namespace Pocket {
         Objects objects;
         using ObjectsFreeIndicies = std::vector<int>;
         ObjectsFreeIndicies objectsFreeIndicies;
+        // generation per slot, never shrunk, so handles stay invalid after Clear and Trim
+        std::vector<std::uint32_t> generations;
+        
+        // per object data, indexed by slot
+        using ComponentMasks = std::vector<ComponentMask>;
+        ComponentMasks activeComponents;
+        ComponentMasks enabledComponents;
+        // Intrusive links of the hierarchy, so objects are moved between parents in constant time.
+        // Siblings are kept in the order they were added
+        struct HierarchyNode {
+            GameObject* firstChild = nullptr;
+            GameObject* lastChild = nullptr;
+            GameObject* previous = nullptr;
+            GameObject* next = nullptr;
+            // the Children() list is rebuilt from the links
+            bool childrenDirty = false;
+            // position in depthFirst and number of descendants following it
+            int depthFirstIndex = 0;
+            int descendantCount = 0;
+        };
+        std::vector<HierarchyNode> hierarchy;
+        HierarchyNode rootNode;
+        using ObjectChildren = std::vector<ObjectCollection>;
+        ObjectChildren objectChildren;
+        ObjectCollection rootChildren;
+        ObjectCollection depthFirst;
+        bool depthFirstDirty;
+        
+        struct ObjectProperties {
+            Property<GameObject*> Parent;
+            Property<bool> Enabled;
+            DirtyProperty<bool> WorldEnabled;
+        };
+        // a deque, since properties are bound to their object and must not move
+        std::deque<ObjectProperties> objectProperties;
         
-        using Components = std::array<IContainer*, MaxComponents>;
+        // Indexed by component id, up to the highest id used by an object or system in this world,
+        // null for types not used. Grown when a type is first used, which moves the entries,
+        // so references to them must not be held across calls that may add a component.
+        using Components = std::vector<IContainer*>;
         Components components;
         
-        using ObjectComponents = std::array<std::vector<int>, MaxComponents>;
+        using ObjectComponents = std::vector<ComponentIndex>;
         ObjectComponents objectComponents;
         
+        // objects sharing a component copy on write, per component id and object index
+        std::vector<std::vector<bool>> copyOnWrite;
+        std::vector<int> copyOnWriteCount;
+        std::vector<ComponentID> componentTypes;
+        
+        // version of the last change per component id and object slot, for components tracked by a system.
+        // Changes are stamped with changeVersion, which is stepped by every ForEachChanged
+        std::vector<std::vector<std::uint32_t>> changeVersions;
+        std::vector<int> changeTrackingCount;
+        std::atomic<std::uint32_t> changeVersion;
+        
         using Systems = std::vector<IGameSystem*>;
         Systems systemsIndexed;
         Systems systems;
         using SystemsPerComponent = std::vector<Systems>;
         SystemsPerComponent systemsPerComponent;
+        Systems systemsToCompact;
+        // systems with batched notifications pending, null once removed
+        Systems systemsToNotify;
+        
+        ThreadPool threadPool;
+        ThreadPool::Group systemsGroup;
+        using SystemDependents = std::vector<std::vector<int>>;
+        SystemDependents systemDependents;
+        std::vector<int> systemDependencies;
+        std::unique_ptr<std::atomic<int>[]> pendingDependencies;
+        bool systemGraphDirty;
+        float updateDt;
+        
+        CommandBuffer createCommands;
+        CommandBuffer removeCommands;
+        PropertyBatch propertyBatch;
+        
+        // objects created or removed together, referenced by EnableBatch and RemoveBatch commands
+        struct ObjectBatch {
+            ComponentMask mask;
+            ObjectCollection objects;
+        };
+        std::vector<ObjectBatch> objectBatches;
+        int objectBatchCount;
+        Systems matchingSystems;
+        ObjectCollection hierarchyStack;
+        ObjectCollection hierarchyObjects;
         
-        using Action = std::function<void()>;
-        using Actions = std::vector<Action>;
-        Actions createActions;
-        Actions removeActions;
+        using Prefabs = std::vector<std::unique_ptr<Prefab>>;
+        Prefabs prefabs;
+        ObjectCollection instantiatedObjects;
+        std::vector<int> createdIndices;
+        
+        struct RecordingContext {
+            GameWorld* world;
+            int system;
+            int step;
+            int item;
+            int sequence;
+        };
+        static RecordingContext& Recording();
+        using Recorders = std::vector<std::unique_ptr<CommandRecorder>>;
+        Recorders recorders;
+        std::vector<RecordedCommand> recordedCommands;
+        ObjectCollection createdObjects;
         
         int objectCount;
         
+        StorageMode storageMode;
+        using Archetypes = std::vector<Archetype>;
+        Archetypes archetypes;
+        using ArchetypeIndices = std::unordered_map<ComponentMask, int>;
+        ArchetypeIndices archetypeIndices;
+        using ArchetypeLocations = std::vector<ArchetypeLocation>;
+        ArchetypeLocations archetypeLocations;
+        std::vector<bool> archetypeDirty;
+        std::vector<int> archetypeDirtyObjects;
+        
+        struct SharedRow {
+            ComponentID id;
+            int index;
+            int source;
+            int object;
+        };
+        std::vector<SharedRow> sharedRows;
+        
+        // objects with components outside their archetype, ie. shared or in containers without blocks
+        std::vector<int> looseObjects;
+        std::vector<int> looseObjectIndices;
+        
+        // storage dropped by Clear with background teardown
+        struct Teardown {
+            Objects objects;
+            std::deque<ObjectProperties> objectProperties;
+            ComponentMasks activeComponents;
+            ComponentMasks enabledComponents;
+            ObjectChildren objectChildren;
+            std::vector<HierarchyNode> hierarchy;
+            Archetypes archetypes;
+            ArchetypeLocations archetypeLocations;
+            ObjectComponents objectComponents;
+            std::vector<std::unique_ptr<IContainer>> containers;
+        };
+        bool backgroundTeardown;
+        std::thread teardownThread;
+        void StartTeardown();
+        void WaitForTeardown();
+        
+        double defragmentSeconds;
+        std::size_t defragmentBytes;
+        // next object slot to defragment, and next component type to trim once all slots are done, else -1
+        int defragmentCursor;
+        int defragmentTrim;
+        int UsedSlots() const;
+        void TrimObjects(int size);
+        
+        void TryAddComponentContainer(ComponentID id, std::function<IContainer*()> constructor);
+        
+        template<typename T>
+        ComponentID AddComponentType() {
+            ComponentID id = GameIDHelper::GetComponentID<T>();
+            TryAddComponentContainer(id, [](){ return new typename ComponentContainer<T>::Type(); });
+            return id;
+        }
+        
+        void CreateObjects(const ComponentMask& mask, int count, ObjectCollection& created);
+        void CaptureNode(Prefab& prefab, GameObject* object, int parent);
+        void Instantiate(Prefab& prefab, int count, ObjectCollection& roots, GameObject* parent);
+        void AllocateObjects(int count, ObjectCollection& created);
+        void AttachNew(GameObject* object, GameObject* parent);
+        int AddSlot();
+        void ReserveSlots(int size);
+        void AddComponents(ComponentID id, const ObjectCollection& objects);
+        void RemoveComponents(ComponentID id, const ObjectCollection& objects);
+        ObjectBatch& AddBatch(int& index);
+        void EnableBatch(int batchIndex);
+        void CommitRemoveBatch(int batchIndex);
+        void EnableComponents(int batchIndex, ComponentID id);
+        void CommitRemoveComponents(int batchIndex, ComponentID id);
+        void FindSystemsWith(ComponentID id, const ComponentMask& mask, Systems& result) const;
+        void FindSystems(const ComponentMask& mask, Systems& result) const;
+        HierarchyNode& Node(const GameObject* object) {
+            return object == &root ? rootNode : hierarchy[object->slot];
+        }
+        void Link(GameObject* object, GameObject* parent);
+        void Unlink(GameObject* object, GameObject* parent);
+        const ObjectCollection& Children(const GameObject* object);
+        ObjectRange Descendants(const GameObject* object);
+        void GatherSubtree(GameObject* object, bool rebuild, ObjectCollection& subtree);
+        void SetWorldEnabledDirty(GameObject* object);
+        void UpdateEnabled(GameObject* root);
+        bool IsCopyOnWrite(ComponentID id, int objectIndex) const;
+        void SetCopyOnWrite(ComponentID id, int objectIndex, bool enable);
+        int Detach(ComponentID id, int objectIndex);
+        int TryDetach(ComponentID id, int objectIndex, int componentIndex);
+        void DetachAll(ComponentID id, const ObjectCollection& objects);
+        
+        // gives the objects their own copy of the components the system writes
+        template<typename... T>
+        void DetachWritten(const ObjectCollection& objects) {
+            const ComponentID ids[] = { -1, GameIDHelper::GetComponentID<T>()... };
+            const bool writes[] = { false, !std::is_const<T>::value... };
+            for(int i=1; i<sizeof(ids) / sizeof(ids[0]); ++i) {
+                if (writes[i] && copyOnWriteCount[ids[i]]>0) {
+                    DetachAll(ids[i], objects);
+                }
+            }
+        }
+        void TrackChanges(const ComponentMask& mask, int amount);
+        
+        void MarkChanged(ComponentID id, int slot) {
+            if (changeTrackingCount[id]>0) {
+                changeVersions[id][slot] = changeVersion.load(std::memory_order_relaxed);
+            }
+        }
+        
+        // stamps the components the system writes as changed
+        template<typename... T>
+        void MarkWritten(const ObjectCollection& objects) {
+            const ComponentID ids[] = { -1, GameIDHelper::GetComponentID<T>()... };
+            const bool writes[] = { false, !std::is_const<T>::value... };
+            for(int i=1; i<sizeof(ids) / sizeof(ids[0]); ++i) {
+                if (writes[i] && changeTrackingCount[ids[i]]>0) {
+                    std::uint32_t version = changeVersion.load(std::memory_order_relaxed);
+                    std::vector<std::uint32_t>& versions = changeVersions[ids[i]];
+                    for(auto object : objects) {
+                        versions[object->slot] = version;
+                    }
+                }
+            }
+        }
+        
         IGameSystem* TryAddSystem(SystemID id, std::function<IGameSystem*(std::vector<int>& components)> constructor);
         void TryRemoveSystem(SystemID id);
-        void DoActions(Actions& actions);
+        void DoCommands(CommandBuffer& commands);
+        void CompactSystems();
+        void NotifySystems();
+        RecordedCommand* Record(RecordedCommand::Type type, GameObject* object, ComponentID component = -1, GameObject* source = 0, StagedComponent* value = 0);
+        CommandRecorder& CurrentRecorder();
+        void ReplayRecorded();
+        GameObject* ResolvePlaceholder(GameObject* object) const;
+        void BuildSystemGraph();
+        void UpdateSystemsParallel(float dt);
+        static void UpdateSystemTask(void* data, int index);
         void IterateObjects(std::function<void(GameObject*)> callback);
         
+        void SetArchetypeDirty(int objectIndex);
+        void SyncArchetypes();
+        void DetachSharedRows();
+        void MoveToArchetype(int objectIndex, const ComponentMask& mask);
+        int FindArchetype(const ComponentMask& mask);
+        void SetLoose(int objectIndex, bool loose);
+        
+        template<typename... T, typename Function, std::size_t... I>
+        void IterateChunks(Function& function, std::index_sequence<I...>) {
+            assert(storageMode == StorageMode::Archetypes);
+            const ComponentID ids[] = { GameIDHelper::GetComponentID<T>()... };
+            ComponentMask mask;
+            for(auto id : ids) {
+                mask[id] = true;
+            }
+            for(auto& archetype : archetypes) {
+                if (!archetype.mask.Contains(mask)) continue;
+                const int columns[] = { archetype.Column(ids[I])... };
+                for(auto& chunk : archetype.chunks) {
+                    if (chunk.count == 0) continue;
+                    function(chunk.count, &static_cast<Container<T>*>(components[ids[I]])->entries[chunk.blocks[columns[I]]]...);
+                }
+            }
+        }
+        
         friend class GameObject;
         friend class IGameSystem;
+        friend class Prefab;
+        template<typename...> friend class GameSystem;
+        template<typename, typename> friend class HierarchySystem;
     };
     
     
     template<typename T>
     T* GameObject::GetComponent() {
         ComponentID id = GameIDHelper::GetComponentID<T>();
-        int componentIndex = world->objectComponents[id][index];
+        if (id>=world->components.size()) return 0;
+        using ContainerType = typename ComponentContainer<T>::Type;
+        ContainerType* container = static_cast<ContainerType*>(world->components[id]);
+        if (!container) return 0;
+        int componentIndex = world->objectComponents[id].Get(index);
         if (componentIndex == -1) return 0;
-        Container<T>* container = static_cast<Container<T>*>(world->components[id]);
-        return &container->entries[componentIndex];
+        if (!std::is_const<T>::value && world->copyOnWriteCount[id]>0) {
+            componentIndex = world->TryDetach(id, index, componentIndex);
+        }
+        if (!std::is_const<T>::value) {
+            world->MarkChanged(id, slot);
+        }
+        return &(*container)[componentIndex];
+    }
+    
+    template<typename T>
+    T* GameObject::RecordAddComponent() {
+        Staged<T>* staged = new Staged<T>();
+        world->Record(RecordedCommand::Type::AddComponent, this, GameIDHelper::GetComponentID<T>(), 0, staged);
+        return &staged->value;
+    }
+    
+    template<typename... T>
+    template<typename Function>
+    void GameSystem<T...>::ForEach(Function&& function) {
+        ForEach(function, typename TakesObject<Function>::Type());
+    }
+    
+    template<typename... T>
+    template<typename Function, std::size_t... I>
+    void GameSystem<T...>::ForEach(Function& function, std::index_sequence<I...>) {
+        const ComponentID ids[] = { GameIDHelper::GetComponentID<T>()... };
+        std::tuple<typename ComponentContainer<T>::Type*...> containers {
+            static_cast<typename ComponentContainer<T>::Type*>(world->components[ids[I]])...
+        };
+        world->DetachWritten<T...>(Objects());
+        world->MarkWritten<T...>(Objects());
+        
+        // function may add a component type, which moves the indices
+        const auto& objectComponents = world->objectComponents;
+        const ComponentIndex* indices = objectComponents.data();
+        if (world->storageMode == StorageMode::Containers) {
+            for(auto object : Objects()) {
+                function(object, (*std::get<I>(containers))[indices[ids[I]][object->index]]...);
+                indices = objectComponents.data();
+            }
+            return;
+        }
+        
+        ComponentMask mask;
+        for(auto id : ids) {
+            mask[id] = true;
+        }
+        for(auto& archetype : world->archetypes) {
+            if (!archetype.mask.Contains(mask)) continue;
+            const int columns[] = { archetype.Column(ids[I])... };
+            for(auto& chunk : archetype.chunks) {
+                if (chunk.count == 0) continue;
+                std::tuple<T*...> rows { &(*std::get<I>(containers))[chunk.blocks[columns[I]]]... };
+                for(int row = 0; row < chunk.count; ++row) {
+                    if (!chunk.enabled[row]) continue;
+                    function(&world->objects[chunk.objects[row]], std::get<I>(rows)[row]...);
+                }
+            }
+        }
+        for(auto objectIndex : world->looseObjects) {
+            GameObject* object = &world->objects[objectIndex];
+            if (!world->enabledComponents[objectIndex].Contains(mask)) continue;
+            const ArchetypeLocation& location = world->archetypeLocations[objectIndex];
+            if (location.archetype>=0 && world->archetypes[location.archetype].mask.Contains(mask)) continue;
+            function(object, (*std::get<I>(containers))[indices[ids[I]][objectIndex]]...);
+            indices = objectComponents.data();
+        }
+    }
+    
+    template<typename... T>
+    template<typename Function>
+    void GameSystem<T...>::ParallelForEach(Function&& function, int grainSize, Partition partition) {
+        ParallelForEach(function, grainSize, partition, typename TakesObject<Function>::Type());
+    }
+    
+    template<typename... T>
+    template<typename Function, std::size_t... I>
+    void GameSystem<T...>::ParallelForEach(Function& function, int grainSize, Partition partition, std::index_sequence<I...>) {
+        const ComponentID ids[] = { GameIDHelper::GetComponentID<T>()... };
+        std::tuple<typename ComponentContainer<T>::Type*...> containers {
+            static_cast<typename ComponentContainer<T>::Type*>(world->components[ids[I]])...
+        };
+        // ranges record their calls, so no component type is added while they run
+        const ComponentIndex* indices[] = { &world->objectComponents[ids[I]]... };
+        const ObjectCollection& objects = Objects();
+        world->DetachWritten<T...>(objects);
+        world->MarkWritten<T...>(objects);
+        
+        // ranges record their calls, outside a parallel Update they are made when all ranges are done
+        GameWorld::RecordingContext& current = GameWorld::Recording();
+        bool insideUpdate = current.world == world;
+        int system = insideUpdate ? current.system : -1;
+        int step = insideUpdate ? ++current.step : 0;
+        
+        auto range = [&] (int begin, int end) {
+            GameWorld::RecordingContext& context = GameWorld::Recording();
+            GameWorld::RecordingContext previous = context;
+            context = { world, system, step, begin, 0 };
+            for(int i = begin; i<end; ++i) {
+                GameObject* object = objects[i];
+                function(object, (*std::get<I>(containers))[(*indices[I])[object->index]]...);
+            }
+            context = previous;
+        };
+        world->threadPool.ParallelFor((int)objects.size(), grainSize, partition, range);
+        
+        if (insideUpdate) {
+            ++current.step;
+        } else {
+            world->ReplayRecorded();
+        }
     }
-
     
+    template<typename... T>
+    template<typename Function>
+    void GameSystem<T...>::ForEachChanged(Function&& function) {
+        ForEachChanged(function, typename TakesObject<Function>::Type());
+    }
+    
+    template<typename... T>
+    template<typename Function, std::size_t... I>
+    void GameSystem<T...>::ForEachChanged(Function& function, std::index_sequence<I...>) {
+        assert(trackChanges);
+        const ComponentID ids[] = { GameIDHelper::GetComponentID<T>()... };
+        const bool writes[] = { !std::is_const<T>::value... };
+        std::tuple<typename ComponentContainer<T>::Type*...> containers {
+            static_cast<typename ComponentContainer<T>::Type*>(world->components[ids[I]])...
+        };
+        // function may add a component type, which moves the indices
+        const auto& objectComponents = world->objectComponents;
+        const ComponentIndex* indices = objectComponents.data();
+        
+        // changes from here on are newer than the system's version, and its own writes are stamped with it
+        std::uint32_t since = changeVersion;
+        changeVersion = world->changeVersion.fetch_add(1);
+        for(auto object : Objects()) {
+            bool changed = false;
+            for(auto id : ids) {
+                changed |= world->changeVersions[id][object->slot] > since;
+            }
+            if (!changed) continue;
+            for(int i=0; i<sizeof...(T); ++i) {
+                if (!writes[i]) continue;
+                if (world->copyOnWriteCount[ids[i]]>0 && world->IsCopyOnWrite(ids[i], object->index)) {
+                    world->Detach(ids[i], object->index);
+                }
+                world->changeVersions[ids[i]][object->slot] = changeVersion;
+            }
+            function(object, (*std::get<I>(containers))[indices[ids[I]][object->index]]...);
+            indices = objectComponents.data();
+        }
+    }
     
 }
\ No newline at end of file
@@ -0,0 +1,179 @@
+//
+//  HierarchySystem.hpp
+//  EntitySystem
+//
+//  Created by Jeppe Nielsen on 18/10/26.
+//  Copyright © 2026 Jeppe Nielsen. All rights reserved.
+//
+
+#pragma once
+#include <algorithm>
+#include "GameWorld.hpp"
+
+namespace Pocket {
+
+    // Propagates T from parents to children, eg. world transforms from local ones.
+    // Combine is a function object called as combine(const T* parent, T& component), where parent is null
+    // for objects whose parent isn't in the system. It is called concurrently, and should only touch the
+    // components it is given.
+    // Objects are grouped by depth, and every depth is combined in parallel once the one above it is done.
+    // Only objects whose T changed, whose parent changed, or whose parent was combined are combined,
+    // so changes propagate down their subtree like DirtyProperty::MakeDirty.
+    // Derived systems overriding Initialize, ObjectAdded, ObjectRemoved or ObjectsCleared must call the base version.
+    template<typename T, typename Combine>
+    class HierarchySystem : public GameSystem<T> {
+    public:
+        HierarchySystem() : levelsDirty(false), grainSize(0) {}
+        
+        // grainSize as for ParallelForEach
+        void SetGrainSize(int grainSize) { this->grainSize = grainSize; }
+
+        // combines the changed objects, called by Update
+        void Propagate();
+
+    protected:
+        void Initialize() override;
+        void ObjectAdded(GameObject* object) override;
+        void ObjectRemoved(GameObject* object) override;
+        void ObjectsCleared() override;
+        void Update(float dt) override;
+
+        Combine combine;
+
+    private:
+        // objects per depth, rebuilt when an object is added or removed, or a parent changes
+        std::vector<ObjectCollection> levels;
+        bool levelsDirty;
+        int grainSize;
+
+        // per object slot
+        std::vector<int> depths;
+        std::vector<GameObject*> parents;
+        // set for objects to combine, and kept for combined ones until all depths are done
+        std::vector<char> dirty;
+
+        ObjectCollection stack;
+
+        bool Contains(const GameObject* object) const {
+            return object->slot>=0 && object->slot<this->objectPositions.size() && this->objectPositions[object->slot]>=0;
+        }
+
+        void HierarchyChanged() { levelsDirty = true; }
+        void BuildLevels();
+    };
+
+    template<typename T, typename Combine>
+    void HierarchySystem<T, Combine>::Initialize() {
+        this->TrackChanges();
+    }
+
+    template<typename T, typename Combine>
+    void HierarchySystem<T, Combine>::ObjectAdded(GameObject* object) {
+        if (object->slot>=dirty.size()) {
+            depths.resize(object->slot + 1, -1);
+            parents.resize(object->slot + 1, 0);
+            dirty.resize(object->slot + 1, 0);
+        }
+        dirty[object->slot] = 1;
+        parents[object->slot] = 0;
+        levelsDirty = true;
+        object->Parent().Changed.Bind(this, &HierarchySystem::HierarchyChanged);
+    }
+
+    template<typename T, typename Combine>
+    void HierarchySystem<T, Combine>::ObjectRemoved(GameObject* object) {
+        object->Parent().Changed.Unbind(this, &HierarchySystem::HierarchyChanged);
+        levelsDirty = true;
+    }
+
+    // the base calls ObjectRemoved for every object, like for any other system
+    template<typename T, typename Combine>
+    void HierarchySystem<T, Combine>::ObjectsCleared() {
+        GameSystem<T>::ObjectsCleared();
+        for(auto& level : levels) {
+            level.clear();
+        }
+        levelsDirty = false;
+    }
+
+    template<typename T, typename Combine>
+    void HierarchySystem<T, Combine>::Update(float dt) {
+        Propagate();
+    }
+
+    // depths are found by walking up to the nearest object with a known depth, or one without a parent in the system
+    template<typename T, typename Combine>
+    void HierarchySystem<T, Combine>::BuildLevels() {
+        levelsDirty = false;
+        for(auto& level : levels) {
+            level.clear();
+        }
+        const ObjectCollection& objects = this->Objects();
+        for(auto object : objects) {
+            depths[object->slot] = -1;
+        }
+        for(auto object : objects) {
+            GameObject* current = object;
+            while (depths[current->slot]<0) {
+                stack.push_back(current);
+                GameObject* parent = current->Parent();
+                if (!parent || !Contains(parent)) break;
+                current = parent;
+            }
+            while (!stack.empty()) {
+                current = stack.back();
+                stack.pop_back();
+                GameObject* parent = current->Parent();
+                if (parent && !Contains(parent)) {
+                    parent = 0;
+                }
+                if (parents[current->slot]!=parent) {
+                    parents[current->slot] = parent;
+                    dirty[current->slot] = 1;
+                }
+                int depth = parent ? depths[parent->slot] + 1 : 0;
+                depths[current->slot] = depth;
+                if (depth>=levels.size()) {
+                    levels.resize(depth + 1);
+                }
+                levels[depth].push_back(current);
+            }
+        }
+    }
+
+    template<typename T, typename Combine>
+    void HierarchySystem<T, Combine>::Propagate() {
+        GameWorld* world = this->world;
+        if (levelsDirty) {
+            BuildLevels();
+        }
+        ComponentID id = GameIDHelper::GetComponentID<T>();
+        auto container = static_cast<typename ComponentContainer<T>::Type*>(world->components[id]);
+        const ComponentIndex& indices = world->objectComponents[id];
+        world->DetachWritten<T>(this->Objects());
+
+        // changes newer than the system's version are combined, and so are the objects below them
+        std::uint32_t since = this->changeVersion;
+        this->changeVersion = world->changeVersion.fetch_add(1);
+        std::uint32_t version = this->changeVersion;
+        std::vector<std::uint32_t>& versions = world->changeVersions[id];
+
+        for(auto& level : levels) {
+            auto range = [&] (int begin, int end) {
+                for(int i = begin; i<end; ++i) {
+                    GameObject* object = level[i];
+                    if (object->index<0) continue; // removed, but not yet taken out of the system
+                    int slot = object->slot;
+                    GameObject* parent = parents[slot];
+                    if (!dirty[slot] && versions[slot]<=since && !(parent && dirty[parent->slot])) continue;
+                    dirty[slot] = 1;
+                    const T* parentComponent = parent && parent->index>=0 ? &(*container)[indices[parent->index]] : 0;
+                    combine(parentComponent, (*container)[indices[object->index]]);
+                    versions[slot] = version;
+                }
+            };
+            world->threadPool.ParallelFor((int)level.size(), grainSize, Partition::Adaptive, range);
+        }
+        std::fill(dirty.begin(), dirty.end(), 0);
+    }
+}
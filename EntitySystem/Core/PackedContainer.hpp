@@ -0,0 +1,153 @@
+//
+//  PackedContainer.hpp
+//  EntitySystem
+//
+//  Created by Jeppe Nielsen on 17/10/26.
+//  Copyright © 2026 Jeppe Nielsen. All rights reserved.
+//
+
+#pragma once
+#include "Container.hpp"
+
+namespace Pocket {
+
+    // Sparse set container, live entries are kept packed in one array.
+    // Indices handed out by Create are stable, and map to a position in entries,
+    // deleting an entry moves the last entry into its position, by assignment like Defragment.
+    // A component uses it by declaring: using Container = PackedContainer<Component>;
+    template<typename T>
+    class PackedContainer : public IContainer {
+    public:
+        PackedContainer() { count = 0; }
+        virtual ~PackedContainer() { }
+
+        int Create() override {
+            int index;
+            if (freeIndicies.empty()) {
+                index = (int)sparse.size();
+                sparse.push_back(-1);
+            } else {
+                index = freeIndicies.back();
+                freeIndicies.pop_back();
+            }
+            sparse[index] = (int)entries.size();
+            entries.push_back(defaultObject);
+            references.push_back(1);
+            indicies.push_back(index);
+            ++count;
+            return index;
+        }
+
+        void Reference(int index) override {
+            ++references[sparse[index]];
+        }
+
+        void Delete(int index) override {
+            int position = sparse[index];
+            --references[position];
+            if (references[position]>0) return;
+
+            int last = (int)entries.size() - 1;
+            if (position != last) {
+                // constructed again first, so the moved entry doesn't take on state of the deleted instance
+                entries[position].~T();
+                new (&entries[position]) T(defaultObject);
+                entries[position] = std::move(entries[last]);
+                references[position] = references[last];
+                indicies[position] = indicies[last];
+                sparse[indicies[position]] = position;
+            }
+            entries.pop_back();
+            references.pop_back();
+            indicies.pop_back();
+            sparse[index] = -1;
+            freeIndicies.push_back(index);
+            --count;
+        }
+
+        int Clone(int index) override {
+            int cloneIndex = Create();
+            entries.back() = entries[sparse[index]];
+            return cloneIndex;
+        }
+
+        void* Get(int index) override {
+            return &entries[sparse[index]];
+        }
+
+        T& operator[](int index) {
+            return entries[sparse[index]];
+        }
+
+        int ReferenceCount(int index) const override {
+            return references[sparse[index]];
+        }
+
+        // entries never move between indices, so there is nothing to pack into blocks
+        bool CanCreateBlocks() const override { return false; }
+        int CreateBlock() override { assert(false); return -1; }
+        void DeleteBlock(int index) override { assert(false); }
+        bool IsBlock(int index) const override { return false; }
+        void Move(int from, int to) override { assert(false); }
+        int Move(int from) override { return from; }
+
+        void Iterate(std::function<void(T* object)> function) {
+            for(auto& entry : entries) {
+                function(&entry);
+            }
+        }
+
+        void Clear() override {
+            entries.clear();
+            references.clear();
+            indicies.clear();
+            sparse.clear();
+            freeIndicies.clear();
+            count = 0;
+        }
+
+        IContainer* Release() override {
+            PackedContainer* released = new PackedContainer();
+            released->entries.swap(entries);
+            released->references.swap(references);
+            released->indicies.swap(indicies);
+            released->sparse.swap(sparse);
+            Clear();
+            return released;
+        }
+
+        int EntrySize() const override { return (int)sizeof(T); }
+
+        void Trim() override {
+            int smallestSize = 0;
+            for(int i = (int)sparse.size() - 1; i>=0; --i) {
+                if (sparse[i]>=0) {
+                    smallestSize = i + 1;
+                    break;
+                }
+            }
+            sparse.resize(smallestSize);
+            freeIndicies.erase(std::remove_if(freeIndicies.begin(), freeIndicies.end(), [smallestSize] (int index) {
+                return index >= smallestSize;
+            }), freeIndicies.end());
+            entries.shrink_to_fit();
+            references.shrink_to_fit();
+            indicies.shrink_to_fit();
+        }
+
+        using Entries = std::vector<T>;
+        Entries entries;
+
+        using References = std::vector<int>;
+        References references;
+
+        using Indicies = std::vector<int>;
+        Indicies indicies;
+        Indicies sparse;
+
+        using FreeIndicies = std::vector<int>;
+        FreeIndicies freeIndicies;
+
+        T defaultObject;
+    };
+}
@@ -0,0 +1,16 @@
+//
+//  Prefab.cpp
+//  EntitySystem
+//
+//  Created by Jeppe Nielsen on 17/10/26.
+//  Copyright © 2026 Jeppe Nielsen. All rights reserved.
+//
+
+#include "Prefab.hpp"
+#include "GameWorld.hpp"
+
+using namespace Pocket;
+
+void Prefab::Instantiate(int count, ObjectCollection& roots, GameObject* parent) {
+    world->Instantiate(*this, count, roots, parent);
+}
@@ -0,0 +1,60 @@
+//
+//  Prefab.hpp
+//  EntitySystem
+//
+//  Created by Jeppe Nielsen on 17/10/26.
+//  Copyright © 2026 Jeppe Nielsen. All rights reserved.
+//
+
+#pragma once
+#include <vector>
+#include "GameIDHelper.hpp"
+#include "GameObject.hpp"
+
+namespace Pocket {
+
+    class GameWorld;
+
+    // A captured object hierarchy, created by GameWorld::CreatePrefab.
+    // The prefab keeps its own copy of every component of the captured objects, so changing them
+    // afterwards doesn't change the prefab. Copies are entries in the world's containers, ie. they are
+    // visited by Container::Iterate. Prefabs are owned by the world, and removed by GameWorld::Clear.
+    class Prefab {
+    public:
+        // instances reference the prefab's T, rather than each getting a copy of it
+        template<typename T>
+        void Share() {
+            shared[GameIDHelper::GetComponentID<T>()] = true;
+        }
+
+        // Creates count copies of the hierarchy, their roots are appended to roots, and put under parent,
+        // or under the world's root when parent is null. All objects are created in one pass,
+        // and the systems interested in each object of the hierarchy are found once in Update.
+        // Cannot be called by systems updating on workers.
+        void Instantiate(int count, ObjectCollection& roots, GameObject* parent = 0);
+
+        int NodeCount() const { return (int)nodes.size(); }
+
+    private:
+        Prefab(GameWorld* world) : world(world) {}
+
+        // nodes are depth first, so a parent comes before its children
+        struct Node {
+            int parent;
+            bool enabled;
+            ComponentMask mask;
+            int firstComponent;
+            int componentCount;
+        };
+        struct Component {
+            ComponentID id;
+            int index;
+        };
+        std::vector<Node> nodes;
+        std::vector<Component> components;
+        ComponentMask shared;
+        GameWorld* world;
+
+        friend class GameWorld;
+    };
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <functional>
 #include "Event.hpp"
 
 namespace Pocket {
@@ -38,6 +39,8 @@ namespace Pocket {
         
         std::function<void(Value&)> Method;
     
+        bool IsDirty() const { return isDirty; }
+    
 		void MakeDirty() {
             if (isDirty) return;
             isDirty = true;
@@ -7,147 +7,324 @@
 //
 
 #pragma once
-#include <vector>
-#include <functional>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <type_traits>
 
 namespace Pocket {
+
+// Returned by Event::Bind, unbinds the delegate it was returned for
+struct EventToken {
+    int index = -1;
+    int id = 0;
+};
+
+// Delegates are stored by value in one array, the first one inside the event itself,
+// so binding a member function or a small lambda doesn't allocate.
+// Unbinding leaves a hole which is skipped when invoking, holes are closed once they outnumber the delegates.
 template<typename... T>
 class Event {
 private:
-    
-    template<typename...Args>
-    struct IDelegate {
-        int type;
-        virtual ~IDelegate() {}
-        virtual void Invoke(Args... values) = 0;
+    static const int StorageSize = 4 * sizeof(void*);
+    using Storage = typename std::aligned_storage<StorageSize, alignof(void*)>::type;
+
+    struct Delegate {
+        Storage storage;
+        // null once unbound
+        void (*invoke)(const Storage& storage, T... values);
+        // null when storage holds nothing to destroy
+        void (*destroy)(Storage& storage);
+        int id;
     };
-    using Delegate = IDelegate<T...>;
-    using Delegates = std::vector<Delegate*>;
-    Delegates delegates;
-    
+
     template<typename Obj>
-    struct IDelegateMember : public IDelegate<T...> {
+    struct Member {
         Obj* object;
         void (Obj::*method)(T...);
-        
-        void Invoke(T... values) override {
-            (object->*method)(std::forward<T>(values)...);
+
+        bool operator==(const Member& other) const { return object == other.object && method == other.method; }
+
+        static void Invoke(const Storage& storage, T... values) {
+            const Member& member = reinterpret_cast<const Member&>(storage);
+            (member.object->*member.method)(std::forward<T>(values)...);
         }
     };
-    
+
     template<typename Obj, typename Context>
-    struct IDelegateMemberContext : public IDelegate<T...> {
+    struct MemberContext {
         Obj* object;
-        Context context;
         void (Obj::*method)(T..., Context);
-        
-        void Invoke(T... values) override {
-            (object->*method)(std::forward<T>(values)..., context);
+        Context context;
+
+        bool operator==(const MemberContext& other) const {
+            return object == other.object && method == other.method && context == other.context;
+        }
+
+        static void Invoke(const Storage& storage, T... values) {
+            const MemberContext& member = reinterpret_cast<const MemberContext&>(storage);
+            (member.object->*member.method)(std::forward<T>(values)..., member.context);
+        }
+    };
+
+    template<typename Lambda>
+    struct InlineLambda {
+        static void Invoke(const Storage& storage, T... values) {
+            reinterpret_cast<const Lambda&>(storage)(std::forward<T>(values)...);
         }
     };
-    
-    struct IDelegateLambda : public IDelegate<T...> {
-        std::function<void(T...)> function;
-        void Invoke(T... values) override {
-            function(std::forward<T>(values)...);
+
+    template<typename Lambda>
+    struct HeapLambda {
+        static void Invoke(const Storage& storage, T... values) {
+            (*reinterpret_cast<Lambda* const&>(storage))(std::forward<T>(values)...);
         }
+        static void Destroy(Storage& storage) {
+            delete reinterpret_cast<Lambda*&>(storage);
+        }
+    };
+
+    template<typename Lambda>
+    struct IsConstCallable {
+        template<typename L>
+        static std::true_type Test(decltype(std::declval<const L&>()(std::declval<T>()...))*);
+        template<typename L>
+        static std::false_type Test(...);
+        using Type = decltype(Test<Lambda>(0));
+    };
+
+    // stored in place when they are copied with their bytes, and calling them doesn't change them,
+    // as a delegate is copied when invoked
+    template<typename Lambda>
+    struct FitsInline {
+        static const bool value = sizeof(Lambda) <= StorageSize && alignof(Lambda) <= alignof(Storage) &&
+                                  std::is_trivially_copyable<Lambda>::value && IsConstCallable<Lambda>::Type::value;
     };
-    
-    static int objectIDCounter;
-    
-    template<typename O>
-    int GetObjectID() {
-        static int id = objectIDCounter++;
-        return id;
-    }
-    
+
+    Delegate* delegates;
+    int count;
+    int capacity;
+    int removed;
+    int nextId;
+    int invoking;
+    Delegate first;
+
+    void Reset() {
+        delegates = &first;
+        count = 0;
+        capacity = 1;
+        removed = 0;
+        nextId = 0;
+        invoking = 0;
+    }
+
+    Delegate& Add() {
+        if (count == capacity) {
+            int newCapacity = capacity * 2;
+            Delegate* grown = static_cast<Delegate*>(::operator new(sizeof(Delegate) * newCapacity));
+            std::memcpy(grown, delegates, sizeof(Delegate) * count);
+            if (delegates != &first) {
+                ::operator delete(delegates);
+            }
+            delegates = grown;
+            capacity = newCapacity;
+        }
+        Delegate& delegate = delegates[count++];
+        delegate.destroy = 0;
+        delegate.id = nextId++;
+        return delegate;
+    }
+
+    EventToken TokenOf(const Delegate& delegate) const {
+        EventToken token;
+        token.index = (int)(&delegate - delegates);
+        token.id = delegate.id;
+        return token;
+    }
+
+    // a delegate unbound while invoking may be the one running, so it is released once invoking is done
+    void Remove(Delegate& delegate) {
+        if (!delegate.invoke) return;
+        delegate.invoke = 0;
+        ++removed;
+        if (invoking) return;
+        Release(delegate);
+        if (removed * 2 > count) {
+            Compact();
+        }
+    }
+
+    void Release(Delegate& delegate) {
+        if (delegate.destroy) {
+            delegate.destroy(delegate.storage);
+            delegate.destroy = 0;
+        }
+    }
+
+    // keeps the order delegates were bound in, so ids stay increasing
+    void Compact() {
+        int live = 0;
+        for(int i=0; i<count; ++i) {
+            if (delegates[i].invoke) {
+                delegates[live++] = delegates[i];
+            } else {
+                Release(delegates[i]);
+            }
+        }
+        count = live;
+        removed = 0;
+    }
+
+    // delegates only move towards the front, so a moved delegate is found by its id before its old index
+    Delegate* Find(const EventToken& token) {
+        if (token.index<0) return 0;
+        int index = token.index < count ? token.index : count - 1;
+        if (index>=0 && delegates[index].id == token.id) {
+            return &delegates[index];
+        }
+        int low = 0;
+        int high = index;
+        while (low<=high) {
+            int middle = (low + high) / 2;
+            int id = delegates[middle].id;
+            if (id == token.id) return &delegates[middle];
+            if (id < token.id) {
+                low = middle + 1;
+            } else {
+                high = middle - 1;
+            }
+        }
+        return 0;
+    }
+
+    template<typename Key>
+    void RemoveMatching(void (*invoke)(const Storage&, T...), const Key& key) {
+        for(int i=0; i<count; ++i) {
+            Delegate& delegate = delegates[i];
+            if (delegate.invoke != invoke) continue;
+            if (!(reinterpret_cast<const Key&>(delegate.storage) == key)) continue;
+            Remove(delegate);
+            return;
+        }
+    }
+
 public:
-    
-    Event() = default;
-    Event(const Event<T...>& other) { delegates.clear(); }
-    Event(Event<T...>& other) { delegates.clear(); }
-    void operator=(const Event<T...>& other) { delegates.clear(); }
-    void operator=(Event<T...>& other) { delegates.clear(); }
-    
+
+    Event() { Reset(); }
+    Event(const Event<T...>& other) { Reset(); }
+    Event(Event<T...>& other) { Reset(); }
+    void operator=(const Event<T...>& other) { Clear(); }
+    void operator=(Event<T...>& other) { Clear(); }
+
     Event(Event&& other) {
-        delegates = other.delegates;
-        other.delegates.clear();
+        Reset();
+        if (other.delegates == &other.first) {
+            first = other.first;
+            count = other.count;
+        } else {
+            delegates = other.delegates;
+            count = other.count;
+            capacity = other.capacity;
+        }
+        removed = other.removed;
+        nextId = other.nextId;
+        other.Reset();
+    }
+
+    ~Event() {
+        Clear();
+        if (delegates != &first) {
+            ::operator delete(delegates);
+        }
     }
-    
-    ~Event() { Clear(); }
-    
+
     void Clear() noexcept {
-        for(auto d : delegates) delete d;
-        delegates.clear();
+        for(int i=0; i<count; ++i) {
+            if (delegates[i].invoke) {
+                delegates[i].invoke = 0;
+                ++removed;
+            }
+        }
+        if (!invoking) {
+            Compact();
+        }
     }
-    
+
     bool Empty() const noexcept {
-        return delegates.empty();
+        return count == removed;
     }
-    
+
+    // delegates bound while invoking are called from the next invocation
     void operator () (T... values) {
-        for(auto d : delegates) {
-            d->Invoke(values...);
+        ++invoking;
+        int end = count;
+        for(int i=0; i<end; ++i) {
+            if (!delegates[i].invoke) continue;
+            Delegate delegate = delegates[i];
+            delegate.invoke(delegate.storage, values...);
+        }
+        if (--invoking == 0 && removed > 0) {
+            Compact();
         }
     }
-    
+
     template<typename Obj>
-    void Bind(Obj* object, void (Obj::*method)(T...)) {
-        IDelegateMember<Obj>* delegate = new IDelegateMember<Obj>();
-        delegate->type = GetObjectID<Obj>();
-        delegate->object = object;
-        delegate->method = method;
-        delegates.push_back(delegate);
-    }
-    
+    EventToken Bind(Obj* object, void (Obj::*method)(T...)) {
+        Delegate& delegate = Add();
+        new (&delegate.storage) Member<Obj> { object, method };
+        delegate.invoke = &Member<Obj>::Invoke;
+        return TokenOf(delegate);
+    }
+
     template<typename Obj>
     void Unbind(Obj* object, void (Obj::*method)(T...)) {
-        short typeID = GetObjectID<Obj>();
-        for(int i=0; i<delegates.size(); ++i) {
-            auto d = delegates[i];
-            if (d->type != typeID) continue;
-            IDelegateMember<Obj>* delegate = (IDelegateMember<Obj>*)(d);
-            if (delegate->object != object) continue;
-            if (delegate->method != method) continue;
-            delegates.erase(delegates.begin() + i);
-            return;
-        }
+        RemoveMatching(&Member<Obj>::Invoke, Member<Obj> { object, method });
     }
-    
+
     template<typename Obj, typename Context>
-    void Bind(Obj* object, void (Obj::*method)(T..., Context), Context context) {
-        IDelegateMemberContext<Obj, Context>* delegate = new IDelegateMemberContext<Obj, Context>();
-        delegate->type = 10000 + GetObjectID<Obj>() + GetObjectID<Context>() * 10000;
-        delegate->object = object;
-        delegate->method = method;
-        delegate->context = context;
-        delegates.push_back(delegate);
-    }
-    
+    EventToken Bind(Obj* object, void (Obj::*method)(T..., Context), Context context) {
+        static_assert(sizeof(MemberContext<Obj, Context>) <= StorageSize && std::is_trivially_copyable<Context>::value,
+                      "context must be small and trivially copyable, bind a lambda instead");
+        Delegate& delegate = Add();
+        new (&delegate.storage) MemberContext<Obj, Context> { object, method, context };
+        delegate.invoke = &MemberContext<Obj, Context>::Invoke;
+        return TokenOf(delegate);
+    }
+
     template<typename Obj, typename Context>
     void Unbind(Obj* object, void (Obj::*method)(T..., Context), Context context) {
-        int typeID = 10000 + GetObjectID<Obj>() + GetObjectID<Context>() * 10000;
-        for(int i=0; i<delegates.size(); ++i) {
-            auto d = delegates[i];
-            if (d->type != typeID) continue;
-            IDelegateMemberContext<Obj, Context>* delegate = (IDelegateMemberContext<Obj, Context>*)(d);
-            if (delegate->object != object) continue;
-            if (delegate->method != method) continue;
-            if (delegate->context != context) continue;
-            delegates.erase(delegates.begin() + i);
-            return;
-        }
+        RemoveMatching(&MemberContext<Obj, Context>::Invoke, MemberContext<Obj, Context> { object, method, context });
     }
-    
+
     template<typename Lambda>
-    void Bind(Lambda&& lambda) {
-        IDelegateLambda* delegate = new IDelegateLambda();
-        delegate->type = -1;
-        delegate->function = lambda;
-        delegates.push_back(delegate);
+    EventToken Bind(Lambda&& lambda) {
+        using Type = typename std::decay<Lambda>::type;
+        return BindLambda<Type>(std::forward<Lambda>(lambda), std::integral_constant<bool, FitsInline<Type>::value>());
+    }
+
+    void Unbind(const EventToken& token) {
+        Delegate* delegate = Find(token);
+        if (delegate) {
+            Remove(*delegate);
+        }
     }
-};
 
-template<typename...T>
-int Event<T...>::objectIDCounter = 0;
-}
\ No newline at end of file
+private:
+    template<typename Type, typename Lambda>
+    EventToken BindLambda(Lambda&& lambda, std::true_type) {
+        Delegate& delegate = Add();
+        new (&delegate.storage) Type(std::forward<Lambda>(lambda));
+        delegate.invoke = &InlineLambda<Type>::Invoke;
+        return TokenOf(delegate);
+    }
+
+    template<typename Type, typename Lambda>
+    EventToken BindLambda(Lambda&& lambda, std::false_type) {
+        Delegate& delegate = Add();
+        new (&delegate.storage) Type*(new Type(std::forward<Lambda>(lambda)));
+        delegate.invoke = &HeapLambda<Type>::Invoke;
+        delegate.destroy = &HeapLambda<Type>::Destroy;
+        return TokenOf(delegate);
+    }
+};
+}
@@ -8,6 +8,7 @@
 
 #pragma once
 #include "Event.hpp"
+#include "PropertyBatch.hpp"
 
 namespace Pocket {
 
@@ -15,25 +16,59 @@ template<class Value>
 class Property {
 private:
     Value value;
+    Value previousValue {};
+    PropertyBatch* batch = nullptr;
+    bool pending = false;
     
     void Set(const Value& newValue) {
         if (value==newValue) return;
+        if (batch) {
+            if (!pending) {
+                pending = true;
+                previousValue = value;
+                batch->Add(this, &Property::Notify, &Property::Reset);
+            }
+            value = newValue;
+            return;
+        }
         previousValue = value;
         value = newValue;
         Changed();
     }
-    static Value previousValue;
+    
+    static void Notify(void* property) {
+        Property* self = static_cast<Property*>(property);
+        self->pending = false;
+        if (self->value == self->previousValue) return;
+        self->Changed();
+    }
+    
+    static void Reset(void* property) {
+        static_cast<Property*>(property)->pending = false;
+    }
 public:
     Property() = default;
 
     Event<> Changed;
     
-    Value& PreviousValue() const;
+    // value before the last change, or before the first change since the batch was flushed
+    const Value& PreviousValue() const { return previousValue; }
+    
+    // With a batch, setting the property doesn't fire Changed. The property is recorded in the batch instead,
+    // and Changed is fired once by PropertyBatch::Flush if the value differs from the value before the first set.
+    // The property can then be set from several threads, as long as each property is set by one thread at a time.
+    // A property destroyed while recorded is removed from the batch. Copies and assignments don't take
+    // the batch along, and component containers construct unused entries again, so a component reusing
+    // an entry doesn't inherit the batch.
+    void SetBatch(PropertyBatch* batch) { this->batch = batch; }
     
     const Value& operator() () const { return value; }
     operator const Value& () const { return value; }
     
     void operator = (const Value& v) { Set(v); }
+    
+    // sets the value without firing Changed, for owners that apply the change themselves
+    void SetWithoutNotify(const Value& v) { value = v; }
     void operator = (const Property<Value>& v) { Set(v.value); }
     Value operator - () const { return -value; }
     
@@ -80,14 +115,10 @@ public:
     Property(const Property<Value>& other) {
         value = other.value;
     }
+    
+    ~Property() {
+        if (pending) batch->Remove(this);
+    }
 };
 
-template<class Value>
-Value Property<Value>::previousValue;
-
-template<class Value>
-Value& Property<Value>::PreviousValue() const {
-    return previousValue;
-}
-
 };
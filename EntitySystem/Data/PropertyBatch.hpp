@@ -0,0 +1,75 @@
+//
+//  PropertyBatch.hpp
+//  EntitySystem
+//
+//  Created by Jeppe Nielsen on 17/10/26.
+//  Copyright © 2026 Jeppe Nielsen. All rights reserved.
+//
+
+#pragma once
+#include <vector>
+#include <mutex>
+
+namespace Pocket {
+
+    // Properties changed since the last Flush, see Property::SetBatch.
+    // A property is recorded once however many times it is set, recording is thread safe.
+    class PropertyBatch {
+    public:
+        void Add(void* property, void (*notify)(void* property), void (*reset)(void* property)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            entries.push_back({ property, notify, reset });
+        }
+
+        // forgets a property destroyed while recorded
+        void Remove(void* property) {
+            std::lock_guard<std::mutex> lock(mutex);
+            for(auto& entry : entries) {
+                if (entry.property == property) entry.property = nullptr;
+            }
+            for(auto& entry : flushing) {
+                if (entry.property == property) entry.property = nullptr;
+            }
+        }
+
+        // notifies the recorded properties, changes made while notifying are notified in the same pass
+        void Flush() {
+            while (true) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (entries.empty()) return;
+                    flushing.swap(entries);
+                }
+                for(auto& entry : flushing) {
+                    if (entry.property) entry.notify(entry.property);
+                }
+                flushing.clear();
+            }
+        }
+
+        // forgets the recorded properties without notifying them, eg. before they are destroyed.
+        // The properties are reset, so they are recorded again when next set.
+        void Clear() {
+            std::lock_guard<std::mutex> lock(mutex);
+            for(auto& entry : entries) {
+                if (entry.property) entry.reset(entry.property);
+            }
+            entries.clear();
+        }
+
+        bool Empty() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return entries.empty();
+        }
+
+    private:
+        struct Entry {
+            void* property;
+            void (*notify)(void* property);
+            void (*reset)(void* property);
+        };
+        std::mutex mutex;
+        std::vector<Entry> entries;
+        std::vector<Entry> flushing;
+    };
+}
@@ -8,7 +8,11 @@
 
 #include "LogicTests.hpp"
 #include "GameWorld.hpp"
+#include "HierarchySystem.hpp"
 #include <cstdlib>
+#include <algorithm>
+#include <memory>
+#include <mutex>
 
 using namespace Pocket;
 
@@ -472,4 +476,1190 @@ void LogicTests::RunTests() {
     });
 
     
+    AddTest("Archetype storage packs components", []() {
+        struct Position { int x; };
+        struct Velocity { int dx; };
+        GameWorld world;
+        world.SetStorageMode(StorageMode::Archetypes);
+        std::vector<GameObject*> objects;
+        for(int i=0; i<600; ++i) {
+            GameObject* o = world.CreateObject();
+            o->AddComponent<Position>()->x = i;
+            if (i % 2 == 0) {
+                o->AddComponent<Velocity>()->dx = 1;
+            }
+            objects.push_back(o);
+        }
+        world.Update(0);
+        int count = 0;
+        int sum = 0;
+        world.IterateChunks<Position, Velocity>([&](int size, Position* positions, Velocity* velocities) {
+            count += size;
+            for(int i=0; i<size; ++i) {
+                sum += positions[i].x + velocities[i].dx;
+            }
+        });
+        bool valuesKept = true;
+        for(int i=0; i<objects.size(); ++i) {
+            valuesKept &= objects[i]->GetComponent<Position>()->x == i;
+        }
+        return count == 300 && sum == 299 * 300 + 300 && valuesKept;
+    });
+    
+    AddTest("Archetype storage RemoveComponent/Remove", []() {
+        struct Position { int x; };
+        struct Velocity { int dx; };
+        GameWorld world;
+        world.SetStorageMode(StorageMode::Archetypes);
+        std::vector<GameObject*> objects;
+        for(int i=0; i<300; ++i) {
+            GameObject* o = world.CreateObject();
+            o->AddComponent<Position>()->x = i;
+            o->AddComponent<Velocity>()->dx = i;
+            objects.push_back(o);
+        }
+        world.Update(0);
+        for(int i=0; i<300; i+=3) {
+            objects[i]->RemoveComponent<Velocity>();
+            objects[i+1]->Remove();
+        }
+        world.Update(0);
+        int bothCount = 0;
+        world.IterateChunks<Position, Velocity>([&](int size, Position* positions, Velocity* velocities) {
+            bothCount += size;
+        });
+        int positionCount = 0;
+        world.IterateChunks<Position>([&](int size, Position* positions) {
+            positionCount += size;
+        });
+        bool valuesKept = true;
+        for(int i=0; i<300; ++i) {
+            if (i % 3 == 1) continue;
+            valuesKept &= objects[i]->GetComponent<Position>()->x == i;
+            if (i % 3 == 2) {
+                valuesKept &= objects[i]->GetComponent<Velocity>()->dx == i;
+            } else {
+                valuesKept &= !objects[i]->HasComponent<Velocity>();
+            }
+        }
+        return bothCount == 100 && positionCount == 200 && valuesKept && world.ObjectCount() == 200;
+    });
+    
+    AddTest("Archetype storage Reference component", []() {
+        struct Position { int x; };
+        GameWorld world;
+        world.SetStorageMode(StorageMode::Archetypes);
+        GameObject* source = world.CreateObject();
+        source->AddComponent<Position>()->x = 123;
+        world.Update(0);
+        GameObject* copy = world.CreateObject();
+        Position* copyPosition = copy->AddComponent<Position>(source);
+        bool sharedBeforeUpdate = copyPosition == source->GetComponent<Position>();
+        world.Update(0);
+        bool sharedAfterUpdate = copy->GetComponent<Position>() == source->GetComponent<Position>();
+        int packed = 0;
+        world.IterateChunks<Position>([&](int size, Position* positions) {
+            packed += size;
+        });
+        return sharedBeforeUpdate && sharedAfterUpdate && copy->GetComponent<Position>()->x == 123 && packed == 0;
+    });
+    
+    AddTest("PackedContainer component", []() {
+        struct Particle {
+            Particle() : life(10) {}
+            int life;
+            using Container = PackedContainer<Particle>;
+        };
+        GameWorld world;
+        std::vector<GameObject*> objects;
+        for(int i=0; i<10; ++i) {
+            GameObject* o = world.CreateObject();
+            o->AddComponent<Particle>()->life = i;
+            objects.push_back(o);
+        }
+        GameObject* shared = world.CreateObject();
+        bool referenced = shared->AddComponent<Particle>(objects[9]) == objects[9]->GetComponent<Particle>();
+        GameObject* cloned = world.CreateObject();
+        Particle* clone = cloned->CloneComponent<Particle>(objects[8]);
+        bool wasCloned = clone != objects[8]->GetComponent<Particle>() && clone->life == 8;
+        for(int i=0; i<10; i+=2) {
+            objects[i]->RemoveComponent<Particle>();
+        }
+        world.Update(0);
+        auto container = world.GetContainer<Particle>();
+        bool isPacked = container->entries.size() == 6 && container->Count() == 6;
+        bool valuesKept = true;
+        for(int i=1; i<10; i+=2) {
+            valuesKept &= objects[i]->GetComponent<Particle>()->life == i;
+        }
+        valuesKept &= shared->GetComponent<Particle>() == objects[9]->GetComponent<Particle>();
+        valuesKept &= cloned->GetComponent<Particle>()->life == 8;
+        return referenced && wasCloned && isPacked && valuesKept;
+    });
+    
+    AddTest("GameSystem::ForEach", []() {
+        struct Position { int x; };
+        struct Velocity { int dx; };
+        struct MovementSystem : public GameSystem<Position, Velocity> {
+            void Update(float dt) {
+                ForEach([] (Position& position, Velocity& velocity) {
+                    position.x += velocity.dx;
+                });
+            }
+        };
+        GameWorld world;
+        world.CreateSystem<MovementSystem>();
+        std::vector<GameObject*> objects;
+        for(int i=0; i<10; ++i) {
+            GameObject* o = world.CreateObject();
+            o->AddComponent<Position>()->x = i;
+            if (i<5) {
+                o->AddComponent<Velocity>()->dx = 10;
+            }
+            objects.push_back(o);
+        }
+        world.Update(0);
+        world.Update(0);
+        bool moved = true;
+        for(int i=0; i<10; ++i) {
+            moved &= objects[i]->GetComponent<Position>()->x == (i<5 ? i + 10 : i);
+        }
+        return moved;
+    });
+    
+    AddTest("GameSystem::ForEach with GameObject", []() {
+        struct Position { int x; };
+        struct PositionSystem : public GameSystem<Position> { };
+        GameWorld world;
+        auto system = world.CreateSystem<PositionSystem>();
+        GameObject* object = world.CreateObject();
+        object->AddComponent<Position>()->x = 5;
+        world.Update(0);
+        int count = 0;
+        bool correct = true;
+        system->ForEach([&] (GameObject* o, Position& position) {
+            correct &= o == object && &position == object->GetComponent<Position>();
+            count++;
+        });
+        return correct && count == 1;
+    });
+    
+    AddTest("GameSystem::ForEach archetype storage", []() {
+        struct Position { int x; };
+        struct Velocity { int dx; };
+        struct MovementSystem : public GameSystem<Position, Velocity> { };
+        GameWorld world;
+        world.SetStorageMode(StorageMode::Archetypes);
+        auto system = world.CreateSystem<MovementSystem>();
+        std::vector<GameObject*> objects;
+        for(int i=0; i<300; ++i) {
+            GameObject* o = world.CreateObject();
+            o->AddComponent<Position>()->x = i;
+            o->AddComponent<Velocity>()->dx = 1;
+            objects.push_back(o);
+        }
+        GameObject* shared = world.CreateObject();
+        shared->AddComponent<Position>()->x = 1000;
+        shared->AddComponent<Velocity>(objects[0]);
+        objects[1]->Enabled() = false;
+        world.Update(0);
+        int count = 0;
+        int sum = 0;
+        system->ForEach([&] (GameObject* o, Position& position, Velocity& velocity) {
+            count++;
+            sum += position.x + velocity.dx;
+        });
+        int expectedSum = 299 * 150 - 1 + 299 + 1000 + 1;
+        return count == 300 && count == system->Objects().size() && sum == expectedSum;
+    });
+    
+    AddTest("Parallel systems keep order of conflicting systems", []() {
+        struct Value { int x; };
+        struct Other { int y; };
+        struct DoubleSystem : public GameSystem<Value> {
+            void Update(float dt) { ForEach([] (Value& value) { value.x *= 2; }); }
+        };
+        struct ReadSystem : public GameSystem<const Value, Other> {
+            void Update(float dt) { ForEach([] (const Value& value, Other& other) { other.y = value.x; }); }
+        };
+        struct IncrementSystem : public GameSystem<Value> {
+            void Update(float dt) { ForEach([] (Value& value) { value.x += 1; }); }
+        };
+        struct OtherSystem : public GameSystem<Other> {
+            void Update(float dt) { ForEach([] (Other& other) { other.y += 1000; }); }
+        };
+        
+        auto run = [] (int workers) {
+            GameWorld world;
+            world.SetWorkerCount(workers);
+            world.CreateSystem<DoubleSystem>();
+            world.CreateSystem<ReadSystem>();
+            world.CreateSystem<IncrementSystem>();
+            world.CreateSystem<OtherSystem>();
+            std::vector<GameObject*> objects;
+            for(int i=0; i<1000; ++i) {
+                GameObject* o = world.CreateObject();
+                o->AddComponent<Value>()->x = i;
+                o->AddComponent<Other>()->y = 0;
+                objects.push_back(o);
+            }
+            world.Update(0);
+            for(int i=0; i<4; ++i) {
+                world.Update(0);
+            }
+            std::vector<int> result;
+            for(auto o : objects) {
+                result.push_back(o->GetComponent<Value>()->x);
+                result.push_back(o->GetComponent<Other>()->y);
+            }
+            return result;
+        };
+        return run(0) == run(4);
+    });
+    
+    AddTest("GameSystem::ParallelForEach", []() {
+        struct Position { int x; int start; };
+        struct Velocity { int x; };
+        struct MovementSystem : public GameSystem<Position, const Velocity> { };
+        
+        GameWorld world;
+        world.SetWorkerCount(4);
+        MovementSystem* system = world.CreateSystem<MovementSystem>();
+        for(int i=0; i<10000; ++i) {
+            GameObject* object = world.CreateObject();
+            object->AddComponent<Position>()->x = i;
+            object->GetComponent<Position>()->start = i;
+            object->AddComponent<Velocity>()->x = 2;
+        }
+        world.Update(0);
+        system->ParallelForEach([] (Position& position, const Velocity& velocity) {
+            position.x += velocity.x;
+        }, 16);
+        
+        int sum = 0;
+        for(auto object : system->Objects()) {
+            Position* position = object->GetComponent<Position>();
+            sum += position->x - position->start;
+        }
+        return sum == 10000 * 2;
+    });
+    
+    AddTest("ThreadPool::ParallelFor deterministic ranges", []() {
+        auto ranges = [] (int workers) {
+            ThreadPool pool;
+            pool.SetWorkerCount(workers);
+            std::mutex mutex;
+            std::vector<std::pair<int, int>> result;
+            auto function = [&] (int begin, int end) {
+                std::lock_guard<std::mutex> lock(mutex);
+                result.push_back({ begin, end });
+            };
+            pool.ParallelFor(1000, 30, Partition::Deterministic, function);
+            std::sort(result.begin(), result.end());
+            return result;
+        };
+        std::vector<std::pair<int, int>> serial = ranges(0);
+        return serial.size() == 34 && serial.back().second == 1000 && serial == ranges(4);
+    });
+    
+    AddTest("Commands recorded while replaying are replayed in same Update", []() {
+        struct A { };
+        struct B { };
+        struct AddBSystem : public GameSystem<A> {
+            void ObjectAdded(GameObject* object) { object->AddComponent<B>(); }
+        };
+        struct BSystem : public GameSystem<B> { };
+        
+        GameWorld world;
+        world.CreateSystem<AddBSystem>();
+        BSystem* bSystem = world.CreateSystem<BSystem>();
+        for(int i=0; i<1000; ++i) {
+            world.CreateObject()->AddComponent<A>();
+        }
+        world.Update(0);
+        return bSystem->Objects().size() == 1000;
+    });
+    
+    AddTest("Changes recorded on workers replay in serial order", []() {
+        struct Spawner { int count; };
+        struct Value { int x; };
+        struct Lifetime { int frames; };
+        struct SpawnSystem : public GameSystem<Spawner> {
+            void Update(float dt) {
+                ParallelForEach([this] (Spawner& spawner) {
+                    GameObject* object = world->CreateObject();
+                    object->AddComponent<Value>()->x = spawner.count++;
+                    object->AddComponent<Lifetime>()->frames = spawner.count % 3;
+                }, 4);
+            }
+        };
+        struct LifetimeSystem : public GameSystem<Lifetime> {
+            void Update(float dt) {
+                ForEach([] (GameObject* object, Lifetime& lifetime) {
+                    if (lifetime.frames-- == 0) {
+                        object->Remove();
+                    }
+                });
+            }
+        };
+        struct ValueSystem : public GameSystem<Value> { };
+        
+        auto run = [] (int workers) {
+            GameWorld world;
+            world.SetWorkerCount(workers);
+            world.CreateSystem<SpawnSystem>();
+            world.CreateSystem<LifetimeSystem>();
+            ValueSystem* values = world.CreateSystem<ValueSystem>();
+            for(int i=0; i<100; ++i) {
+                world.CreateObject()->AddComponent<Spawner>()->count = i * 1000;
+            }
+            for(int i=0; i<10; ++i) {
+                world.Update(0);
+            }
+            std::vector<int> result;
+            for(auto object : values->Objects()) {
+                result.push_back(object->GetComponent<Value>()->x);
+            }
+            return result;
+        };
+        std::vector<int> serial = run(0);
+        return !serial.empty() && serial == run(4) && serial == run(2);
+    });
+    
+    AddTest("System removal swaps in last object", []() {
+        struct Component { };
+        struct ComponentSystem : public GameSystem<Component> { };
+        
+        GameWorld world;
+        ComponentSystem* system = world.CreateSystem<ComponentSystem>();
+        std::vector<GameObject*> objects;
+        for(int i=0; i<5; ++i) {
+            objects.push_back(world.CreateObject());
+            objects.back()->AddComponent<Component>();
+        }
+        world.Update(0);
+        objects[1]->RemoveComponent<Component>();
+        world.Update(0);
+        const ObjectCollection& list = system->Objects();
+        return list.size() == 4 && list[0] == objects[0] && list[1] == objects[4] &&
+               list[2] == objects[2] && list[3] == objects[3];
+    });
+    
+    AddTest("System stable order", []() {
+        struct Component { };
+        struct ComponentSystem : public GameSystem<Component> {
+            void Initialize() { SetStableOrder(true); }
+        };
+        
+        GameWorld world;
+        ComponentSystem* system = world.CreateSystem<ComponentSystem>();
+        std::vector<GameObject*> objects;
+        for(int i=0; i<6; ++i) {
+            objects.push_back(world.CreateObject());
+            objects.back()->AddComponent<Component>();
+        }
+        world.Update(0);
+        objects[1]->RemoveComponent<Component>();
+        objects[3]->Remove();
+        objects[0]->RemoveComponent<Component>();
+        world.Update(0);
+        objects[0]->AddComponent<Component>();
+        world.Update(0);
+        const ObjectCollection& list = system->Objects();
+        return list.size() == 4 && list[0] == objects[2] && list[1] == objects[4] &&
+               list[2] == objects[5] && list[3] == objects[0];
+    });
+    
+    AddTest("Remove parent removes all children", []() {
+        GameWorld world;
+        GameObject* parent = world.CreateObject();
+        for(int i=0; i<5; ++i) {
+            GameObject* child = world.CreateObject();
+            child->Parent() = parent;
+            world.CreateObject()->Parent() = child;
+        }
+        world.Update(0);
+        bool hadAll = world.ObjectCount() == 11 && parent->Children().size() == 5;
+        parent->Remove();
+        world.Update(0);
+        return hadAll && world.ObjectCount() == 0 && world.Root()->Children().empty();
+    });
+    
+    AddTest("Handle to removed object is invalid after slot is reused", []() {
+        GameWorld world;
+        GameObject* object = world.CreateObject();
+        GameObjectHandle handle = object->Handle();
+        bool resolved = world.Resolve(handle) == object;
+        object->Remove();
+        bool invalidAfterRemove = !world.IsValid(handle);
+        world.Update(0);
+        GameObject* reused = world.CreateObject();
+        return resolved && invalidAfterRemove && reused == object &&
+               !world.IsValid(handle) && !world.Resolve(handle) &&
+               world.Resolve(reused->Handle()) == reused &&
+               !world.IsValid(GameObjectHandle());
+    });
+    
+    AddTest("Handles are invalid after Clear", []() {
+        GameWorld world;
+        GameObjectHandle handle = world.CreateObject()->Handle();
+        world.Clear();
+        world.CreateObject();
+        return !world.IsValid(handle);
+    });
+    
+    AddTest("ComponentMask beyond 64 components", []() {
+        ComponentMask mask;
+        mask[3] = true;
+        mask[64] = true;
+        mask[100] = true;
+        ComponentMask required;
+        required[64] = true;
+        required[100] = true;
+        ComponentMask other;
+        other[65] = true;
+        std::vector<ComponentID> ids;
+        mask.Iterate([&ids] (ComponentID id) { ids.push_back(id); });
+        return mask.Contains(required) && !required.Contains(mask) &&
+               !mask.Intersects(other) && mask.Intersects(~other) && !(mask & other).Any() &&
+               ids == std::vector<ComponentID> { 3, 64, 100 } && (mask & required) == required;
+    });
+    
+    AddTest("ComponentIndex allocates pages on first component", []() {
+        ComponentIndex index;
+        index.Set(5, -1);
+        bool noPages = index.PageCount() == 0 && index.Get(5) == -1 && index.Get(1000000) == -1;
+        index.Set(ComponentIndex::PageSize * 3 + 1, 7);
+        bool onePage = index.PageCount() == 1 && index.Get(ComponentIndex::PageSize * 3 + 1) == 7 &&
+                       index.Get(ComponentIndex::PageSize * 3) == -1 && index.Get(0) == -1;
+        index.Set(ComponentIndex::PageSize * 3 + 1, -1);
+        index.Trim(ComponentIndex::PageSize * 4);
+        return noPages && onePage && index.PageCount() == 0;
+    });
+    
+    AddTest("CreateObjects/RemoveObjects", []() {
+        struct Position { int x; };
+        struct Velocity { int x; };
+        struct MovementSystem : public GameSystem<Position, Velocity> {
+            int added = 0;
+            int removed = 0;
+            void ObjectAdded(GameObject* object) { ++added; }
+            void ObjectRemoved(GameObject* object) { ++removed; }
+        };
+        struct PositionSystem : public GameSystem<Position> { };
+        
+        GameWorld world;
+        MovementSystem* movement = world.CreateSystem<MovementSystem>();
+        PositionSystem* positions = world.CreateSystem<PositionSystem>();
+        ObjectCollection objects;
+        world.CreateObjects<Position, Velocity>(100, objects);
+        world.CreateObjects<Position>(50, objects);
+        objects[0]->RemoveComponent<Velocity>();
+        world.Update(0);
+        bool created = objects.size() == 150 && world.ObjectCount() == 150 &&
+                       world.Root()->Children().size() == 150 && objects[1]->GetComponent<Velocity>() &&
+                       movement->Objects().size() == 99 && positions->Objects().size() == 150 &&
+                       movement->added == 100 && movement->removed == 1;
+        
+        GameObject* child = world.CreateObject();
+        child->Parent() = objects[10];
+        ObjectCollection toRemove(objects.begin(), objects.begin() + 120);
+        world.RemoveObjects(toRemove);
+        world.Update(0);
+        return created && world.ObjectCount() == 30 && world.Root()->Children().size() == 30 &&
+               movement->Objects().empty() && movement->removed == 100 && positions->Objects().size() == 30 &&
+               !objects[120]->GetComponent<Velocity>() && objects[120]->GetComponent<Position>();
+    });
+    
+    AddTest("Prefab instantiates hierarchy", []() {
+        struct Position { int x; };
+        struct Config { int value; };
+        struct PositionSystem : public GameSystem<Position> { };
+        
+        GameWorld world;
+        PositionSystem* system = world.CreateSystem<PositionSystem>();
+        GameObject* source = world.CreateObject();
+        source->AddComponent<Position>()->x = 1;
+        GameObject* child = world.CreateObject();
+        child->Parent() = source;
+        child->AddComponent<Position>()->x = 2;
+        child->AddComponent<Config>()->value = 5;
+        
+        Prefab* prefab = world.CreatePrefab(source);
+        prefab->Share<Config>();
+        source->GetComponent<Position>()->x = 100;
+        
+        ObjectCollection roots;
+        prefab->Instantiate(3, roots);
+        world.Update(0);
+        
+        bool hierarchy = roots.size() == 3 && prefab->NodeCount() == 2 && world.ObjectCount() == 8;
+        for(auto root : roots) {
+            hierarchy = hierarchy && root->Parent() == world.Root() && root->Children().size() == 1 &&
+                        root->Children()[0]->Parent() == root;
+        }
+        GameObject* first = roots[0]->Children()[0];
+        GameObject* second = roots[1]->Children()[0];
+        first->GetComponent<Position>()->x = 10;
+        bool cloned = roots[0]->GetComponent<Position>()->x == 1 && second->GetComponent<Position>()->x == 2;
+        bool shared = first->GetComponent<const Config>() == second->GetComponent<const Config>() &&
+                      first->GetComponent<const Config>()->value == 5 &&
+                      first->GetComponent<const Config>() != child->GetComponent<const Config>();
+        
+        world.RemovePrefab(prefab);
+        bool keepsShared = second->GetComponent<const Config>()->value == 5;
+        return hierarchy && cloned && shared && keepsShared && system->Objects().size() == 8;
+    });
+    
+    AddTest("Shared component is copied on write", []() {
+        struct Config { int value; };
+        struct ConfigSystem : public GameSystem<Config> { };
+        struct ReadSystem : public GameSystem<const Config> { };
+        
+        GameWorld world;
+        ConfigSystem* writer = world.CreateSystem<ConfigSystem>();
+        GameObject* source = world.CreateObject();
+        source->AddComponent<Config>()->value = 5;
+        ObjectCollection sharers;
+        for(int i=0; i<3; ++i) {
+            sharers.push_back(world.CreateObject());
+            sharers.back()->ShareComponent<Config>(source);
+        }
+        world.Update(0);
+        
+        bool sharedReads = sharers[0]->GetComponent<const Config>() == source->GetComponent<const Config>() &&
+                           sharers[2]->GetComponent<const Config>()->value == 5;
+        sharers[0]->GetComponent<Config>()->value = 6;
+        bool copied = sharers[0]->GetComponent<const Config>() != sharers[1]->GetComponent<const Config>() &&
+                      sharers[1]->GetComponent<const Config>()->value == 5 && source->GetComponent<const Config>()->value == 5;
+        
+        ReadSystem* reader = world.CreateSystem<ReadSystem>();
+        reader->ForEach([] (const Config& config) { });
+        bool stillShared = sharers[1]->GetComponent<const Config>() == sharers[2]->GetComponent<const Config>();
+        writer->ForEach([] (Config& config) { config.value++; });
+        return sharedReads && copied && stillShared && source->GetComponent<Config>()->value == 6 &&
+               sharers[0]->GetComponent<Config>()->value == 7 && sharers[1]->GetComponent<Config>()->value == 6 &&
+               sharers[1]->GetComponent<Config>() != sharers[2]->GetComponent<Config>();
+    });
+    
+    AddTest("AddComponents/RemoveComponents", []() {
+        struct Health { int value; };
+        struct Stunned { float duration; };
+        struct StunnedSystem : public GameSystem<Health, Stunned> {
+            int added = 0;
+            void ObjectAdded(GameObject* object) { ++added; }
+        };
+        
+        GameWorld world;
+        StunnedSystem* system = world.CreateSystem<StunnedSystem>();
+        ObjectCollection objects;
+        world.CreateObjects<Health>(10, objects);
+        objects.push_back(world.CreateObject());
+        objects[3]->AddComponent<Stunned>()->duration = 1.0f;
+        objects[4]->Enabled() = false;
+        world.Update(0);
+        world.AddComponents<Stunned>(objects, Stunned { 2.0f });
+        world.Update(0);
+        bool added = system->Objects().size() == 9 && system->added == 9 &&
+                     objects[3]->GetComponent<Stunned>()->duration == 1.0f &&
+                     objects[0]->GetComponent<Stunned>()->duration == 2.0f &&
+                     objects[10]->HasComponent<Stunned>() && objects[4]->HasComponent<Stunned>();
+        objects[4]->Enabled() = true;
+        world.Update(0);
+        bool enabledLater = system->Objects().size() == 10;
+        ObjectCollection some(objects.begin(), objects.begin() + 5);
+        world.RemoveComponents<Stunned>(some);
+        world.Update(0);
+        return added && enabledLater && system->Objects().size() == 5 &&
+               !objects[0]->HasComponent<Stunned>() && objects[5]->HasComponent<Stunned>();
+    });
+    
+    AddTest("Batched notifications", []() {
+        struct Transform { int x; };
+        struct Tagged { };
+        struct BatchedSystem : public GameSystem<Transform> {
+            std::vector<int> calls;
+            int objects = 0;
+            bool tag = false;
+            void Initialize() { SetBatchedNotifications(true); }
+            void ObjectAdded(GameObject* object) { calls.push_back(-1); }
+            void ObjectsAdded(const ObjectCollection& added) {
+                calls.push_back((int)added.size());
+                objects += added.size();
+                for(auto object : added) {
+                    if (tag && !object->HasComponent<Tagged>()) {
+                        object->AddComponent<Tagged>();
+                    }
+                }
+            }
+            void ObjectsRemoved(const ObjectCollection& removed) {
+                calls.push_back(-(int)removed.size());
+                objects -= removed.size();
+            }
+        };
+        struct TaggedSystem : public GameSystem<Tagged> { };
+        
+        GameWorld world;
+        GameObject* first = world.CreateObject();
+        first->AddComponent<Transform>();
+        world.Update(0);
+        BatchedSystem* system = world.CreateSystem<BatchedSystem>();
+        TaggedSystem* tagged = world.CreateSystem<TaggedSystem>();
+        bool existing = system->calls.size() == 1 && system->calls[0] == 1;
+        world.Update(0);
+        ObjectCollection objects;
+        world.CreateObjects<Transform>(10, objects);
+        for(int i=0; i<3; ++i) {
+            world.CreateObject()->AddComponent<Transform>();
+        }
+        system->tag = true;
+        world.Update(0);
+        system->tag = false;
+        bool once = system->calls.size() == 2 && system->calls[1] == 13 && tagged->Objects().size() == 13;
+        objects[0]->Remove();
+        objects[1]->Remove();
+        world.Update(0);
+        GameObject* late = world.CreateObject();
+        late->AddComponent<Transform>();
+        late->Remove();
+        world.Update(0);
+        return existing && once && system->calls.size() == 5 && system->calls[2] == -2 &&
+               system->calls[3] == 1 && system->calls[4] == -1 &&
+               system->objects == (int)system->Objects().size() && system->objects == 12;
+    });
+    
+    AddTest("ForEachChanged", []() {
+        struct Transform { int x = 0; };
+        struct Mesh { int vertices = 0; };
+        struct Bounds { int x = 0; };
+        struct BoundsSystem : public GameSystem<const Transform, const Mesh, Bounds> {
+            void Initialize() { TrackChanges(); }
+            int Count() {
+                int count = 0;
+                ForEachChanged([&count] (const Transform& transform, const Mesh& mesh, Bounds& bounds) {
+                    bounds.x = transform.x + mesh.vertices;
+                    ++count;
+                });
+                return count;
+            }
+        };
+        
+        GameWorld world;
+        ObjectCollection objects;
+        world.CreateObjects<Transform, Mesh, Bounds>(10, objects);
+        world.Update(0);
+        BoundsSystem* system = world.CreateSystem<BoundsSystem>();
+        bool all = system->Count() == 10;
+        bool none = system->Count() == 0;
+        objects[2]->GetComponent<Transform>()->x = 5;
+        objects[3]->GetComponent<const Mesh>();
+        objects[4]->MarkChanged<Mesh>();
+        bool written = system->Count() == 2 && objects[2]->GetComponent<const Bounds>()->x == 5;
+        GameObject* added = world.CreateObject();
+        added->AddComponent<Transform>();
+        added->AddComponent<Mesh>();
+        added->AddComponent<Bounds>();
+        objects[5]->Enabled() = false;
+        world.Update(0);
+        bool afterAdd = system->Count() == 1;
+        objects[5]->Enabled() = true;
+        world.Update(0);
+        return all && none && written && afterAdd && system->Count() == 1 && system->Count() == 0;
+    });
+    
+    AddTest("Event bind and unbind", []() {
+        struct Listener {
+            int calls = 0;
+            void Changed(int value) { calls += value; }
+        };
+        
+        Event<int> event;
+        Listener first;
+        Listener second;
+        event.Bind(&first, &Listener::Changed);
+        event.Bind(&second, &Listener::Changed);
+        int lambdaCalls = 0;
+        EventToken lambda = event.Bind([&lambdaCalls] (int value) { lambdaCalls += value; });
+        std::string captured(64, 'x');
+        int heapCalls = 0;
+        event.Bind([captured, &heapCalls] (int value) { heapCalls += (int)captured.size(); });
+        event(1);
+        bool allCalled = first.calls == 1 && second.calls == 1 && lambdaCalls == 1 && heapCalls == 64;
+        
+        event.Unbind(&first, &Listener::Changed);
+        event.Unbind(lambda);
+        event.Unbind(lambda);
+        event(2);
+        bool unbound = first.calls == 1 && second.calls == 3 && lambdaCalls == 1 && heapCalls == 128;
+        
+        // unbinding itself and binding another while invoking
+        EventToken self;
+        int selfCalls = 0;
+        self = event.Bind([&event, &self, &selfCalls, &first] (int value) {
+            ++selfCalls;
+            event.Unbind(self);
+            event.Bind(&first, &Listener::Changed);
+        });
+        event(1);
+        event(1);
+        event.Clear();
+        event(1);
+        return allCalled && unbound && selfCalls == 1 && first.calls == 2 && second.calls == 5 && event.Empty();
+    });
+    
+    AddTest("Property previous value per instance", []() {
+        Property<int> a;
+        Property<int> b;
+        a.SetWithoutNotify(0);
+        b.SetWithoutNotify(0);
+        a = 1;
+        b = 10;
+        a = 2;
+        b = 20;
+        return a.PreviousValue() == 1 && b.PreviousValue() == 10;
+    });
+    
+    AddTest("Batched Property changes", []() {
+        struct Health {
+            Health() { Value.SetWithoutNotify(0); }
+            Property<int> Value;
+            int changes = 0;
+            int previous = -1;
+        };
+        struct RegenSystem : public GameSystem<Health> {
+            void ObjectAdded(GameObject* object) {
+                Health* health = object->GetComponent<Health>();
+                health->Value.SetBatch(&world->Properties());
+                health->Value.Changed.Bind([health] () {
+                    health->changes++;
+                    health->previous = health->Value.PreviousValue();
+                });
+            }
+            void Update(float dt) {
+                ParallelForEach([] (Health& health) {
+                    health.Value += 1;
+                    health.Value += 1;
+                }, 16);
+            }
+        };
+        
+        GameWorld world;
+        world.SetWorkerCount(3);
+        world.CreateSystem<RegenSystem>();
+        ObjectCollection objects;
+        world.CreateObjects<Health>(1000, objects);
+        world.Update(0);
+        world.Update(0);
+        bool coalesced = true;
+        for(auto object : objects) {
+            Health* health = object->GetComponent<Health>();
+            coalesced &= health->changes == 1 && health->previous == 0 && health->Value == 2;
+        }
+        Health* health = objects[0]->GetComponent<Health>();
+        health->Value = health->Value + 1;
+        health->Value = health->Value - 1;
+        world.SetWorkerCount(0);
+        world.Properties().Flush();
+        return coalesced && health->changes == 1 && world.Properties().Empty();
+    });
+    
+    AddTest("Disabling a subtree updates systems in one pass", []() {
+        struct Transform { int x; };
+        struct Renderable { int imageNo; };
+        struct RenderSystem : public GameSystem<Transform, Renderable> {
+            int added = 0;
+            int removed = 0;
+            void ObjectAdded(GameObject* object) { ++added; }
+            void ObjectRemoved(GameObject* object) { ++removed; }
+        };
+        
+        GameWorld world;
+        RenderSystem* system = world.CreateSystem<RenderSystem>();
+        GameObject* root = world.CreateObject();
+        root->AddComponent<Transform>();
+        ObjectCollection children;
+        for(int i=0; i<10; ++i) {
+            GameObject* child = world.CreateObject();
+            child->Parent() = root;
+            child->AddComponent<Transform>();
+            child->AddComponent<Renderable>();
+            GameObject* grandChild = world.CreateObject();
+            grandChild->Parent() = child;
+            grandChild->AddComponent<Transform>();
+            grandChild->AddComponent<Renderable>();
+            children.push_back(child);
+        }
+        world.Update(0);
+        bool allAdded = system->Objects().size() == 20 && system->added == 20;
+        
+        children[0]->Enabled() = false;
+        root->Enabled() = false;
+        bool worldDisabled = !children[3]->WorldEnabled() && !children[3]->Children()[0]->WorldEnabled();
+        world.Update(0);
+        bool allRemoved = system->Objects().size() == 0 && system->removed == 20 &&
+                          root->HasComponent<Transform>();
+        
+        root->Enabled() = true;
+        world.Update(0);
+        return allAdded && worldDisabled && allRemoved && system->Objects().size() == 18 && system->added == 38 &&
+               !children[0]->WorldEnabled() && !children[0]->Children()[0]->WorldEnabled() && children[1]->WorldEnabled();
+    });
+    
+    AddTest("Hierarchy links and depth first order", []() {
+        GameWorld world;
+        GameObject* a = world.CreateObject();
+        GameObject* b = world.CreateObject();
+        ObjectCollection children;
+        for(int i=0; i<5; ++i) {
+            children.push_back(world.CreateObject());
+            children.back()->Parent() = a;
+        }
+        GameObject* grandChild = world.CreateObject();
+        grandChild->Parent() = children[1];
+        
+        children[2]->Parent() = b;
+        children[0]->Parent() = b;
+        bool ordered = a->Children().size() == 3 && a->Children()[0] == children[1] &&
+                       a->Children()[2] == children[4] && b->Children()[0] == children[2] && b->Children()[1] == children[0];
+        
+        ObjectRange descendants = a->Descendants();
+        bool depthFirst = descendants.size() == 4 && descendants[0] == children[1] && descendants[1] == grandChild &&
+                          descendants[2] == children[3] && world.DepthFirst().size() == 8 &&
+                          world.DepthFirst()[0] == a && b->Descendants().size() == 2 && grandChild->Descendants().empty();
+        
+        a->Remove();
+        world.Update(0);
+        return ordered && depthFirst && world.ObjectCount() == 3 && b->Children().size() == 2 &&
+               world.DepthFirst().size() == 3 && world.Root()->Children().size() == 1;
+    });
+    
+    AddTest("HierarchySystem propagates changed subtrees", []() {
+        struct Transform {
+            int local = 0;
+            int world = 0;
+            int combined = 0;
+        };
+        struct Combine {
+            void operator()(const Transform* parent, Transform& transform) const {
+                transform.world = (parent ? parent->world : 0) + transform.local;
+                ++transform.combined;
+            }
+        };
+        
+        GameWorld world;
+        world.SetWorkerCount(2);
+        world.CreateSystem<HierarchySystem<Transform, Combine>>();
+        auto create = [&world] (GameObject* parent, int local) {
+            GameObject* object = world.CreateObject();
+            object->Parent() = parent;
+            object->AddComponent<Transform>()->local = local;
+            return object;
+        };
+        GameObject* root = create(0, 1);
+        GameObject* a = create(root, 10);
+        GameObject* a1 = create(a, 100);
+        GameObject* b = create(root, 20);
+        GameObject* c = create(0, 5);
+        auto get = [] (GameObject* object) { return object->GetComponent<const Transform>(); };
+        world.Update(0);
+        world.Update(0);
+        bool propagated = get(a1)->world == 111 && get(b)->world == 21 && get(c)->world == 5 &&
+                          get(root)->combined == 1 && get(a1)->combined == 1;
+        
+        a->GetComponent<Transform>()->local = 30;
+        world.Update(0);
+        bool subtree = get(a)->world == 31 && get(a1)->world == 131 && get(a1)->combined == 2 &&
+                       get(b)->combined == 1 && get(root)->combined == 1;
+        
+        a1->Parent() = c;
+        world.Update(0);
+        world.Update(0);
+        return propagated && subtree && get(a1)->world == 105 && get(a1)->combined == 3 &&
+               get(a)->combined == 2 && get(c)->combined == 1;
+    });
+    
+    AddTest("Clear notifies systems once and tears down in the background", []() {
+        struct Transform { int x; };
+        struct Resource { std::shared_ptr<int> data; };
+        struct TransformSystem : public GameSystem<Transform> {
+            int removed = 0;
+            int cleared = 0;
+            int clearedObjects = 0;
+            void ObjectRemoved(GameObject* object) override { ++removed; }
+            void ObjectsCleared() override {
+                ++cleared;
+                clearedObjects = (int)Objects().size();
+            }
+        };
+        
+        std::weak_ptr<int> resource;
+        bool notifiedOnce;
+        bool recreated;
+        {
+            GameWorld world;
+            world.SetBackgroundTeardown(true);
+            TransformSystem* system = world.CreateSystem<TransformSystem>();
+            ObjectCollection objects;
+            world.CreateObjects<Transform>(100, objects);
+            objects[0]->AddComponent<Resource>()->data = std::make_shared<int>(1);
+            resource = objects[0]->GetComponent<Resource>()->data;
+            GameObjectHandle handle = objects[0]->Handle();
+            world.Update(0);
+            world.Clear();
+            notifiedOnce = system->cleared == 1 && system->clearedObjects == 100 && system->removed == 0 &&
+                           system->Objects().empty() && world.ObjectCount() == 0 && !world.IsValid(handle);
+            
+            world.CreateObject()->AddComponent<Transform>();
+            world.Update(0);
+            world.Clear();
+            recreated = system->cleared == 2 && system->clearedObjects == 1;
+        }
+        return notifiedOnce && recreated && resource.expired();
+    });
+    
+    AddTest("Defragment moves components into free entries", []() {
+        struct Value { int x; };
+        GameWorld world;
+        ObjectCollection objects;
+        world.CreateObjects<Value>(2000, objects);
+        for(int i=0; i<objects.size(); ++i) {
+            objects[i]->GetComponent<Value>()->x = i;
+        }
+        GameObject* shared = world.CreateObject();
+        shared->ShareComponent<Value>(objects[0]);
+        Prefab* prefab = world.CreatePrefab(objects[1998]);
+        ObjectCollection removed;
+        for(int i=1; i<1900; ++i) {
+            removed.push_back(objects[i]);
+        }
+        world.RemoveObjects(removed);
+        world.Update(0);
+        GameWorld::Fragmentation before = world.GetFragmentation();
+        
+        int steps = 1;
+        while (!world.Defragment(0, 10 * sizeof(Value))) {
+            ++steps;
+        }
+        GameWorld::Fragmentation after = world.GetFragmentation();
+        bool kept = true;
+        for(int i=1900; i<2000; ++i) {
+            kept &= objects[i]->GetComponent<const Value>()->x == i;
+        }
+        
+        shared->GetComponent<Value>()->x = 7;
+        ObjectCollection instances;
+        prefab->Instantiate(1, instances);
+        world.Update(0);
+        return before.freeComponents>=1899 && after.freeComponents<before.freeComponents / 4 && steps>1 &&
+               kept && objects[0]->GetComponent<const Value>()->x == 0 &&
+               shared->GetComponent<const Value>()->x == 7 && instances[0]->GetComponent<const Value>()->x == 1998;
+    });
+    
+    AddTest("Objects created on workers can be parented", []() {
+        struct Spawner { int count; };
+        struct Value { int x; };
+        struct SpawnSystem : public GameSystem<Spawner> {
+            GameObject* parent;
+            bool placeholderEmpty = true;
+            void Update(float dt) {
+                ForEach([this] (Spawner& spawner) {
+                    GameObject* child = world->CreateObject();
+                    child->Parent() = parent;
+                    child->AddComponent<Value>()->x = spawner.count;
+                    placeholderEmpty &= !child->HasComponent<Value>() && !child->GetComponent<Value>();
+                    GameObject* grandChild = world->CreateObject();
+                    grandChild->Parent() = child;
+                    grandChild->Enabled() = false;
+                });
+            }
+        };
+        
+        GameWorld world;
+        world.SetWorkerCount(2);
+        SpawnSystem* system = world.CreateSystem<SpawnSystem>();
+        system->parent = world.CreateObject();
+        world.CreateObject()->AddComponent<Spawner>()->count = 3;
+        world.Update(0);
+        world.Update(0);
+        const ObjectCollection& children = system->parent->Children();
+        if (children.size() != 1 || children[0]->Children().size() != 1) return false;
+        GameObject* grandChild = children[0]->Children()[0];
+        return system->placeholderEmpty && children[0]->GetComponent<Value>()->x == 3 &&
+               grandChild->Parent() == children[0] && !grandChild->Enabled() && children[0]->Enabled();
+    });
+    
+    AddTest("AddComponent on workers keeps existing components", []() {
+        struct Spawner { int count; };
+        struct Value { int x; };
+        struct AddSystem : public GameSystem<Spawner> {
+            ObjectCollection targets;
+            void Update(float dt) {
+                ForEach([this] (Spawner& spawner) {
+                    targets[0]->AddComponent<Value>();
+                    world->AddComponents<Value>(targets, Value { 5 });
+                });
+            }
+        };
+        
+        GameWorld world;
+        world.SetWorkerCount(2);
+        AddSystem* system = world.CreateSystem<AddSystem>();
+        world.CreateObject()->AddComponent<Spawner>();
+        for(int i=0; i<2; ++i) {
+            system->targets.push_back(world.CreateObject());
+        }
+        system->targets[0]->AddComponent<Value>()->x = 42;
+        world.Update(0);
+        world.Update(0);
+        return system->targets[0]->GetComponent<const Value>()->x == 42 &&
+               system->targets[1]->GetComponent<const Value>()->x == 5;
+    });
+    
+    AddTest("Batched Property notifies after world Clear", []() {
+        GameWorld world;
+        Property<int> value;
+        value.SetWithoutNotify(0);
+        value.SetBatch(&world.Properties());
+        int changes = 0;
+        value.Changed.Bind([&changes] () { changes++; });
+        value = 1;
+        world.Clear();
+        value = 2;
+        world.Update(0);
+        return changes == 1 && value.PreviousValue() == 1;
+    });
+    
+    AddTest("Defragment in Update keeps batched properties", []() {
+        struct Health {
+            Health() { Value.SetWithoutNotify(0); }
+            Property<int> Value;
+        };
+        struct HealSystem : public GameSystem<Health> {
+            GameObject* watched = 0;
+            void ObjectAdded(GameObject* object) {
+                if (!watched) return;
+                Health* health = watched->GetComponent<Health>();
+                health->Value.SetBatch(&world->Properties());
+                health->Value = 7;
+            }
+        };
+        
+        GameWorld world;
+        HealSystem* system = world.CreateSystem<HealSystem>();
+        ObjectCollection objects;
+        world.CreateObjects<Health>(2000, objects);
+        world.Update(0);
+        system->watched = objects.back();
+        objects.pop_back();
+        world.RemoveObjects(objects);
+        world.Update(0);
+        
+        world.SetDefragmentBudget(0, 1 << 30);
+        world.CreateObject()->AddComponent<Health>();
+        world.Update(0);
+        world.Update(0);
+        return system->watched->GetComponent<const Health>()->Value == 7 && world.Properties().Empty();
+    });
+    
+    AddTest("Recycled component entries don't keep a Property batch", []() {
+        struct Health {
+            Health() { Value.SetWithoutNotify(0); }
+            Property<int> Value;
+        };
+        struct PackedHealth {
+            using Container = PackedContainer<PackedHealth>;
+            PackedHealth() { Value.SetWithoutNotify(0); }
+            Property<int> Value;
+        };
+        bool notified = true;
+        auto recycle = [&notified] (auto component) {
+            using T = decltype(component);
+            // not flushed by the world, so the properties are still recorded when the components are deleted
+            PropertyBatch batch;
+            GameWorld world;
+            GameObject* first = world.CreateObject();
+            GameObject* second = world.CreateObject();
+            first->AddComponent<T>();
+            second->AddComponent<T>();
+            world.Update(0);
+            int removedChanges = 0;
+            T* batched = first->GetComponent<T>();
+            batched->Value.SetBatch(&batch);
+            batched->Value.Changed.Bind([&removedChanges] () { removedChanges++; });
+            second->GetComponent<T>()->Value.SetBatch(&batch);
+            batched->Value = 3;
+            second->GetComponent<T>()->Value = 3;
+            first->Remove();
+            world.Update(0);
+            
+            T* recycled = world.CreateObject()->AddComponent<T>();
+            int changes = 0;
+            recycled->Value.Changed.Bind([&changes] () { changes++; });
+            recycled->Value = 5;
+            notified &= changes == 1;
+            batch.Flush();
+            world.Update(0);
+            notified &= changes == 1 && removedChanges == 0;
+        };
+        recycle(Health());
+        recycle(PackedHealth());
+        return notified;
+    });
+    
+    AddTest("ForEach adding new component types", []() {
+        struct Value { int x; };
+        struct A { int a; }; struct B { int b; }; struct C { int c; }; struct D { int d; };
+        struct E { int e; }; struct F { int f; }; struct G { int g; }; struct H { int h; };
+        struct ValueSystem : public GameSystem<Value> {
+            int sum = 0;
+            void Update(float dt) {
+                ForEach([this] (GameObject* object, Value& value) {
+                    sum += value.x;
+                    object->AddComponent<A>(); object->AddComponent<B>();
+                    object->AddComponent<C>(); object->AddComponent<D>();
+                    object->AddComponent<E>(); object->AddComponent<F>();
+                    object->AddComponent<G>(); object->AddComponent<H>();
+                });
+            }
+        };
+        GameWorld world;
+        ValueSystem* system = world.CreateSystem<ValueSystem>();
+        for(int i=0; i<4; ++i) {
+            world.CreateObject()->AddComponent<Value>()->x = i + 1;
+        }
+        world.Update(0);
+        world.Update(0);
+        return system->sum == 10;
+    });
+    
+    AddTest("HierarchySystem is told about cleared objects", []() {
+        struct Transform { int local = 0; };
+        struct Combine {
+            void operator()(const Transform* parent, Transform& transform) const { }
+        };
+        struct CountingSystem : public HierarchySystem<Transform, Combine> {
+            int removed = 0;
+            void ObjectRemoved(GameObject* object) override {
+                HierarchySystem<Transform, Combine>::ObjectRemoved(object);
+                ++removed;
+            }
+        };
+        
+        GameWorld world;
+        CountingSystem* system = world.CreateSystem<CountingSystem>();
+        GameObject* root = world.CreateObject();
+        root->AddComponent<Transform>();
+        GameObject* child = world.CreateObject();
+        child->Parent() = root;
+        child->AddComponent<Transform>();
+        world.Update(0);
+        world.Clear();
+        
+        GameObject* object = world.CreateObject();
+        object->AddComponent<Transform>();
+        world.Update(0);
+        world.Update(0);
+        return system->removed == 2 && system->Objects().size() == 1;
+    });
+    
 }
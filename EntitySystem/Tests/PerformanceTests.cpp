@@ -8,8 +8,62 @@
 
 #include "PerformanceTests.hpp"
 #include "GameWorld.hpp"
+#include "HierarchySystem.hpp"
+#include <algorithm>
 using namespace Pocket;
 
+namespace {
+    struct Value { int x; };
+    
+    // 2d affine transforms, world = parent world * local
+    struct Transform {
+        float local[6] = { 1, 0, 0, 1, 0, 0 };
+        float world[6];
+    };
+    
+    void Multiply(const float* a, const float* b, float* result) {
+        result[0] = a[0] * b[0] + a[2] * b[1];
+        result[1] = a[1] * b[0] + a[3] * b[1];
+        result[2] = a[0] * b[2] + a[2] * b[3];
+        result[3] = a[1] * b[2] + a[3] * b[3];
+        result[4] = a[0] * b[4] + a[2] * b[5] + a[4];
+        result[5] = a[1] * b[4] + a[3] * b[5] + a[5];
+    }
+    
+    struct CombineTransform {
+        void operator()(const Transform* parent, Transform& transform) const {
+            if (parent) {
+                Multiply(parent->world, transform.local, transform.world);
+            } else {
+                std::copy(transform.local, transform.local + 6, transform.world);
+            }
+        }
+    };
+    
+    // 10 roots with 4 levels of 10 children below each
+    void CreateTransformTree(GameWorld& world, ObjectCollection& roots) {
+        ObjectCollection level;
+        for(int i=0; i<10; ++i) {
+            GameObject* root = world.CreateObject();
+            root->AddComponent<Transform>();
+            roots.push_back(root);
+            level.push_back(root);
+        }
+        for(int depth=0; depth<4; ++depth) {
+            ObjectCollection next;
+            for(auto parent : level) {
+                for(int i=0; i<10; ++i) {
+                    GameObject* child = world.CreateObject();
+                    child->Parent() = parent;
+                    child->AddComponent<Transform>()->local[4] = (float)i;
+                    next.push_back(child);
+                }
+            }
+            level.swap(next);
+        }
+    }
+}
+
 void PerformanceTests::RunTests() {
     
     AddTest("GameWorld ctor/dtor x 100000", [this]() {
@@ -41,6 +95,23 @@ void PerformanceTests::RunTests() {
     });
     
     
+    AddTest("CreateObject/Remove recycled x 1000 x 1000 frames", [this]() {
+        GameWorld world;
+        ObjectCollection objects;
+        Begin();
+        for(int j=0; j<1000; ++j) {
+            for(int i=0; i<1000; ++i) {
+                objects.push_back(world.CreateObject());
+            }
+            for(auto o : objects) {
+                o->Remove();
+            }
+            objects.clear();
+            world.Update(0);
+        }
+        End();
+    });
+    
     AddTest("AddComponent x 100000", [this]() {
         struct Component { };
         GameWorld world;
@@ -119,5 +190,678 @@ void PerformanceTests::RunTests() {
         End();
     });
     
+    AddTest("RemoveComponent x 1000000 from system", [this]() {
+        struct ComponentSystem : public GameSystem<Value> { };
+        
+        GameWorld world;
+        world.CreateSystem<ComponentSystem>();
+        ObjectCollection objects;
+        for(int i=0; i<1000000; ++i) {
+            objects.push_back(world.CreateObject());
+            objects[i]->AddComponent<Value>();
+        }
+        world.Update(0);
+        
+        Begin();
+        for(int i = 0; i<objects.size(); ++i) {
+            objects[i]->RemoveComponent<Value>();
+        }
+        world.Update(0);
+        End();
+    });
+    
+    AddTest("Archetype IterateChunks x 1000000", [this]() {
+        GameWorld world;
+        world.SetStorageMode(StorageMode::Archetypes);
+        for(int i=0; i<1000000; ++i) {
+            world.CreateObject()->AddComponent<Value>();
+        }
+        world.Update(0);
+        
+        Begin();
+        world.IterateChunks<Value>([](int count, Value* components) {
+            for(int i=0; i<count; ++i) {
+                components[i].x++;
+            }
+        });
+        End();
+    });
+    
+    AddTest("Container::Iterate after churn x 1000000", [this]() {
+        GameWorld world;
+        ObjectCollection objects;
+        for(int i=0; i<1000000; ++i) {
+            objects.push_back(world.CreateObject());
+            objects[i]->AddComponent<Value>();
+        }
+        for(int i=0; i<objects.size(); i+=2) {
+            objects[i]->RemoveComponent<Value>();
+        }
+        world.Update(0);
+        
+        Begin();
+        world.GetContainer<Value>()->Iterate([](Value* component) {
+            component->x++;
+        });
+        End();
+    });
+    
+    AddTest("PackedContainer iterate after churn x 1000000", [this]() {
+        struct Component { int x; using Container = PackedContainer<Component>; };
+        
+        GameWorld world;
+        ObjectCollection objects;
+        for(int i=0; i<1000000; ++i) {
+            objects.push_back(world.CreateObject());
+            objects[i]->AddComponent<Component>();
+        }
+        for(int i=0; i<objects.size(); i+=2) {
+            objects[i]->RemoveComponent<Component>();
+        }
+        world.Update(0);
+        
+        Begin();
+        world.GetContainer<Component>()->Iterate([](Component* component) {
+            component->x++;
+        });
+        End();
+    });
+    
+    AddTest("GameSystem::ForEach x 10000 x 10000", [this]() {
+        struct ComponentSystem : public GameSystem<Value> { };
+        
+        GameWorld world;
+        ComponentSystem* system = world.CreateSystem<ComponentSystem>();
+        for(int i=0; i<10000; ++i) {
+            world.CreateObject()->AddComponent<Value>();
+        }
+        world.Update(0);
+        
+        Begin();
+        for(int j=0; j<10000; ++j) {
+            system->ForEach([] (Value& component) {
+                component.x++;
+            });
+        }
+        End();
+    });
+    
+    auto independentSystems = [this] (int workers) {
+        struct A { float x; };
+        struct B { float x; };
+        struct C { float x; };
+        struct D { float x; };
+        struct SystemA : public GameSystem<A> { void Update(float dt) { ForEach([] (A& c) { for(int i=0; i<100; ++i) c.x = c.x * 0.5f + 1.0f; }); } };
+        struct SystemB : public GameSystem<B> { void Update(float dt) { ForEach([] (B& c) { for(int i=0; i<100; ++i) c.x = c.x * 0.5f + 1.0f; }); } };
+        struct SystemC : public GameSystem<C> { void Update(float dt) { ForEach([] (C& c) { for(int i=0; i<100; ++i) c.x = c.x * 0.5f + 1.0f; }); } };
+        struct SystemD : public GameSystem<D> { void Update(float dt) { ForEach([] (D& c) { for(int i=0; i<100; ++i) c.x = c.x * 0.5f + 1.0f; }); } };
+        
+        GameWorld world;
+        world.SetWorkerCount(workers);
+        world.CreateSystem<SystemA>();
+        world.CreateSystem<SystemB>();
+        world.CreateSystem<SystemC>();
+        world.CreateSystem<SystemD>();
+        for(int i=0; i<100000; ++i) {
+            GameObject* o = world.CreateObject();
+            o->AddComponent<A>();
+            o->AddComponent<B>();
+            o->AddComponent<C>();
+            o->AddComponent<D>();
+        }
+        world.Update(0);
+        
+        Begin();
+        for(int i=0; i<10; ++i) {
+            world.Update(0);
+        }
+        End();
+    };
+    
+    AddTest("4 independent systems x 100000 objects x 10 updates, serial", [independentSystems]() {
+        independentSystems(0);
+    });
+    
+    AddTest("4 independent systems x 100000 objects x 10 updates, 4 workers", [independentSystems]() {
+        independentSystems(4);
+    });
+    
+    auto movement = [this] (int workers, bool parallel) {
+        struct Position { float x, y, z; };
+        struct Velocity { float x, y, z; };
+        struct MovementSystem : public GameSystem<Position, const Velocity> { };
+        
+        GameWorld world;
+        world.SetWorkerCount(workers);
+        MovementSystem* system = world.CreateSystem<MovementSystem>();
+        for(int i=0; i<800000; ++i) {
+            GameObject* o = world.CreateObject();
+            o->AddComponent<Position>();
+            o->AddComponent<Velocity>()->x = 1.0f;
+        }
+        world.Update(0);
+        
+        auto move = [] (Position& p, const Velocity& v) {
+            p.x += v.x * 0.016f;
+            p.y += v.y * 0.016f;
+            p.z += v.z * 0.016f;
+        };
+        
+        Begin();
+        for(int i=0; i<10; ++i) {
+            if (parallel) {
+                system->ParallelForEach(move);
+            } else {
+                system->ForEach(move);
+            }
+        }
+        End();
+    };
+    
+    AddTest("Movement ForEach x 800000 x 10", [movement]() {
+        movement(0, false);
+    });
+    
+    AddTest("Movement ParallelForEach x 800000 x 10, 4 workers", [movement]() {
+        movement(4, true);
+    });
+    
+    AddTest("AddComponent/RemoveComponent churn x 10000 x 100 updates", [this]() {
+        struct ComponentSystem : public GameSystem<Value> { };
+        
+        GameWorld world;
+        world.CreateSystem<ComponentSystem>();
+        ObjectCollection objects;
+        for(int i=0; i<10000; ++i) {
+            objects.push_back(world.CreateObject());
+        }
+        
+        Begin();
+        for(int j=0; j<100; ++j) {
+            for(auto o : objects) {
+                o->AddComponent<Value>();
+            }
+            world.Update(0);
+            for(auto o : objects) {
+                o->RemoveComponent<Value>();
+            }
+            world.Update(0);
+        }
+        End();
+    });
+    
+    AddTest("GameWorld::Resolve x 1000000", [this]() {
+        GameWorld world;
+        std::vector<GameObjectHandle> handles;
+        for(int i=0; i<1000000; ++i) {
+            handles.push_back(world.CreateObject()->Handle());
+        }
+        Begin();
+        for(auto handle : handles) {
+            world.Resolve(handle);
+        }
+        End();
+    });
+    
+    auto spawnWave = [this] (bool bulk) {
+        struct Projectile { float x, y; };
+        struct ProjectileSystem : public GameSystem<Projectile, Value> { };
+        
+        GameWorld world;
+        world.CreateSystem<ProjectileSystem>();
+        ObjectCollection objects;
+        Begin();
+        for(int wave=0; wave<10; ++wave) {
+            if (bulk) {
+                world.CreateObjects<Projectile, Value>(50000, objects);
+            } else {
+                for(int i=0; i<50000; ++i) {
+                    GameObject* object = world.CreateObject();
+                    object->AddComponent<Projectile>();
+                    object->AddComponent<Value>();
+                    objects.push_back(object);
+                }
+            }
+            world.Update(0);
+            if (bulk) {
+                world.RemoveObjects(objects);
+            } else {
+                for(auto object : objects) {
+                    object->Remove();
+                }
+            }
+            objects.clear();
+            world.Update(0);
+        }
+        End();
+    };
+    
+    AddTest("Spawn/remove wave x 50000 x 10, CreateObject", [spawnWave]() {
+        spawnWave(false);
+    });
+    
+    AddTest("Spawn/remove wave x 50000 x 10, CreateObjects", [spawnWave]() {
+        spawnWave(true);
+    });
+    
+    auto instantiate = [this] (bool prefab) {
+        struct Transform { float x, y, z; };
+        struct Mesh { int vertices[16]; };
+        struct Material { float color[4]; };
+        struct Collider { float radius; };
+        struct TransformSystem : public GameSystem<Transform> { };
+        struct RenderSystem : public GameSystem<const Transform, const Mesh, const Material> { };
+        struct CollisionSystem : public GameSystem<const Transform, Collider> { };
+        
+        GameWorld world;
+        world.CreateSystem<TransformSystem>();
+        world.CreateSystem<RenderSystem>();
+        world.CreateSystem<CollisionSystem>();
+        GameObject* source = world.CreateObject();
+        source->AddComponent<Transform>();
+        source->AddComponent<Collider>();
+        for(int i=0; i<4; ++i) {
+            GameObject* child = world.CreateObject();
+            child->Parent() = source;
+            child->AddComponent<Transform>();
+            child->AddComponent<Mesh>();
+            child->AddComponent<Material>();
+            child->AddComponent<Collider>();
+        }
+        
+        ObjectCollection roots;
+        Begin();
+        if (prefab) {
+            Prefab* p = world.CreatePrefab(source);
+            p->Share<Mesh>();
+            p->Share<Material>();
+            p->Instantiate(20000, roots);
+        } else {
+            for(int i=0; i<20000; ++i) {
+                GameObject* root = world.CreateObject();
+                root->CloneComponent<Transform>(source);
+                root->CloneComponent<Collider>(source);
+                for(auto child : source->Children()) {
+                    GameObject* copy = world.CreateObject();
+                    copy->Parent() = root;
+                    copy->CloneComponent<Transform>(child);
+                    copy->AddComponent<Mesh>(child);
+                    copy->AddComponent<Material>(child);
+                    copy->CloneComponent<Collider>(child);
+                }
+                roots.push_back(root);
+            }
+        }
+        world.Update(0);
+        End();
+    };
+    
+    AddTest("Instantiate 5 objects x 20000, manual", [instantiate]() {
+        instantiate(false);
+    });
+    
+    AddTest("Instantiate 5 objects x 20000, Prefab", [instantiate]() {
+        instantiate(true);
+    });
+    
+    auto statusEffect = [this] (bool bulk) {
+        struct Stunned { float duration; };
+        struct StunnedSystem : public GameSystem<Value, Stunned> { };
+        
+        GameWorld world;
+        world.CreateSystem<StunnedSystem>();
+        ObjectCollection objects;
+        world.CreateObjects<Value>(20000, objects);
+        world.Update(0);
+        Begin();
+        for(int i=0; i<20; ++i) {
+            if (bulk) {
+                world.AddComponents<Stunned>(objects);
+            } else {
+                for(auto object : objects) {
+                    object->AddComponent<Stunned>();
+                }
+            }
+            world.Update(0);
+            if (bulk) {
+                world.RemoveComponents<Stunned>(objects);
+            } else {
+                for(auto object : objects) {
+                    object->RemoveComponent<Stunned>();
+                }
+            }
+            world.Update(0);
+        }
+        End();
+    };
+    
+    AddTest("Add/remove status effect x 20000 x 20, AddComponent", [statusEffect]() {
+        statusEffect(false);
+    });
+    
+    AddTest("Add/remove status effect x 20000 x 20, AddComponents", [statusEffect]() {
+        statusEffect(true);
+    });
+    
+    struct Depth { int value; };
+    // keeps its objects sorted by depth, like a render queue
+    struct SortedSystem : public GameSystem<Depth> {
+        std::vector<std::pair<int, GameObject*>> sorted;
+        void ObjectAdded(GameObject* object) {
+            auto entry = std::make_pair(object->GetComponent<Depth>()->value, object);
+            sorted.insert(std::upper_bound(sorted.begin(), sorted.end(), entry), entry);
+        }
+        void ObjectsAdded(const ObjectCollection& objects) {
+            for(auto object : objects) {
+                sorted.push_back(std::make_pair(object->GetComponent<Depth>()->value, object));
+            }
+            std::sort(sorted.begin(), sorted.end());
+        }
+    };
+    struct BatchedSortedSystem : public SortedSystem {
+        void Initialize() { SetBatchedNotifications(true); }
+    };
+    
+    auto sortedInsert = [this] (bool batched) {
+        GameWorld world;
+        if (batched) {
+            world.CreateSystem<BatchedSortedSystem>();
+        } else {
+            world.CreateSystem<SortedSystem>();
+        }
+        ObjectCollection objects;
+        world.CreateObjects<Depth>(20000, objects);
+        for(int i=0; i<objects.size(); ++i) {
+            objects[i]->GetComponent<Depth>()->value = (i * 7919) % 20000;
+        }
+        Begin();
+        world.Update(0);
+        End();
+    };
+    
+    AddTest("Sorted insert x 20000, ObjectAdded", [sortedInsert]() {
+        sortedInsert(false);
+    });
+    
+    AddTest("Sorted insert x 20000, ObjectsAdded", [sortedInsert]() {
+        sortedInsert(true);
+    });
+    
+    auto staticBounds = [this] (bool changedOnly) {
+        struct Mesh { int vertices[32] = { }; };
+        struct Bounds { int x = 0; };
+        struct BoundsSystem : public GameSystem<const Value, const Mesh, Bounds> {
+            void Initialize() { TrackChanges(); }
+        };
+        
+        GameWorld world;
+        BoundsSystem* system = world.CreateSystem<BoundsSystem>();
+        ObjectCollection objects;
+        world.CreateObjects<Value, Mesh, Bounds>(100000, objects);
+        world.Update(0);
+        auto calculate = [] (const Value& value, const Mesh& mesh, Bounds& bounds) {
+            int maximum = mesh.vertices[0];
+            for(int i=1; i<32; ++i) {
+                maximum = std::max(maximum, mesh.vertices[i]);
+            }
+            bounds.x = value.x + maximum;
+        };
+        Begin();
+        for(int frame = 0; frame<100; ++frame) {
+            // one in a hundred objects move each frame
+            for(int i = frame; i<objects.size(); i+=100) {
+                objects[i]->GetComponent<Value>()->x++;
+            }
+            if (changedOnly) {
+                system->ForEachChanged(calculate);
+            } else {
+                system->ForEach(calculate);
+            }
+        }
+        End();
+    };
+    
+    AddTest("Static bounds x 100000 x 100, ForEach", [staticBounds]() {
+        staticBounds(false);
+    });
+    
+    AddTest("Static bounds x 100000 x 100, ForEachChanged", [staticBounds]() {
+        staticBounds(true);
+    });
+    
+    AddTest("Event Bind/invoke/Unbind x 1000000", [this]() {
+        Event<int> event;
+        int sum = 0;
+        Begin();
+        for(int i=0; i<1000000; ++i) {
+            EventToken token = event.Bind([&sum] (int value) { sum += value; });
+            event(1);
+            event.Unbind(token);
+        }
+        End();
+    });
+    
+    auto propertyWrites = [this] (bool batched) {
+        std::vector<Property<int>> properties(10000);
+        PropertyBatch batch;
+        int changes = 0;
+        for(auto& property : properties) {
+            property.SetWithoutNotify(0);
+            property.Changed.Bind([&changes] () { ++changes; });
+            if (batched) {
+                property.SetBatch(&batch);
+            }
+        }
+        Begin();
+        for(int frame = 0; frame<100; ++frame) {
+            // several writes per property and frame, eg. from different effects
+            for(int write = 0; write<10; ++write) {
+                for(auto& property : properties) {
+                    property += 1;
+                }
+            }
+            batch.Flush();
+        }
+        End();
+    };
+    
+    AddTest("Property set x 10000 x 10 x 100, Changed per set", [propertyWrites]() {
+        propertyWrites(false);
+    });
+    
+    AddTest("Property set x 10000 x 10 x 100, PropertyBatch", [propertyWrites]() {
+        propertyWrites(true);
+    });
+    
+    AddTest("Toggle Enabled of a 10000 object subtree x 100", [this]() {
+        struct Renderable { int imageNo; };
+        struct RenderSystem : public GameSystem<Value, Renderable> { };
+        
+        GameWorld world;
+        world.CreateSystem<RenderSystem>();
+        GameObject* root = world.CreateObject();
+        for(int i=0; i<100; ++i) {
+            GameObject* group = world.CreateObject();
+            group->Parent() = root;
+            for(int j=0; j<99; ++j) {
+                GameObject* object = world.CreateObject();
+                object->Parent() = group;
+                object->AddComponent<Value>();
+                object->AddComponent<Renderable>();
+            }
+        }
+        world.Update(0);
+        Begin();
+        for(int i=0; i<100; ++i) {
+            root->Enabled() = !root->Enabled();
+            world.Update(0);
+        }
+        End();
+    });
+    
+    AddTest("Reparent 10000 children x 100", [this]() {
+        GameWorld world;
+        GameObject* first = world.CreateObject();
+        GameObject* second = world.CreateObject();
+        ObjectCollection objects;
+        for(int i=0; i<10000; ++i) {
+            objects.push_back(world.CreateObject());
+        }
+        Begin();
+        for(int i=0; i<100; ++i) {
+            for(auto object : objects) {
+                object->Parent() = (i & 1) ? first : second;
+            }
+        }
+        End();
+    });
 
-}
\ No newline at end of file
+    AddTest("World transforms by recursing Children(), 111110 objects x 100", [this]() {
+        struct TransformSystem : public GameSystem<Transform> {
+            ObjectCollection roots;
+            void Update(float dt) override {
+                for(auto root : roots) {
+                    Transform* transform = root->GetComponent<Transform>();
+                    std::copy(transform->local, transform->local + 6, transform->world);
+                    Propagate(root, transform);
+                }
+            }
+            void Propagate(GameObject* parent, const Transform* parentTransform) {
+                for(auto child : parent->Children()) {
+                    Transform* transform = child->GetComponent<Transform>();
+                    Multiply(parentTransform->world, transform->local, transform->world);
+                    Propagate(child, transform);
+                }
+            }
+        };
+        GameWorld world;
+        TransformSystem* system = world.CreateSystem<TransformSystem>();
+        CreateTransformTree(world, system->roots);
+        world.Update(0);
+        Begin();
+        for(int i=0; i<100; ++i) {
+            for(auto root : system->roots) {
+                root->GetComponent<Transform>()->local[4] = (float)i;
+            }
+            world.Update(0);
+        }
+        End();
+    });
+    
+    AddTest("World transforms with HierarchySystem and 4 workers, 111110 objects x 100", [this]() {
+        GameWorld world;
+        world.SetWorkerCount(4);
+        world.CreateSystem<HierarchySystem<Transform, CombineTransform>>();
+        ObjectCollection roots;
+        CreateTransformTree(world, roots);
+        world.Update(0);
+        Begin();
+        for(int i=0; i<100; ++i) {
+            for(auto root : roots) {
+                root->GetComponent<Transform>()->local[4] = (float)i;
+            }
+            world.Update(0);
+        }
+        End();
+    });
+    
+    AddTest("World transforms with HierarchySystem, one of 10 subtrees changed x 100", [this]() {
+        GameWorld world;
+        world.CreateSystem<HierarchySystem<Transform, CombineTransform>>();
+        ObjectCollection roots;
+        CreateTransformTree(world, roots);
+        world.Update(0);
+        Begin();
+        for(int i=0; i<100; ++i) {
+            roots[i % 10]->GetComponent<Transform>()->local[4] = (float)i;
+            world.Update(0);
+        }
+        End();
+    });
+    
+    AddTest("Clear 1000000 objects in two systems", [this]() {
+        struct ValueSystem : public GameSystem<Value> { };
+        struct TransformSystem : public GameSystem<Value, Transform> { };
+        GameWorld world;
+        world.CreateSystem<ValueSystem>();
+        world.CreateSystem<TransformSystem>();
+        ObjectCollection objects;
+        world.CreateObjects<Value, Transform>(1000000, objects);
+        world.Update(0);
+        Begin();
+        world.Clear();
+        End();
+    });
+    
+    AddTest("Clear 1000000 objects in two systems with background teardown", [this]() {
+        struct ValueSystem : public GameSystem<Value> { };
+        struct TransformSystem : public GameSystem<Value, Transform> { };
+        GameWorld world;
+        world.SetBackgroundTeardown(true);
+        world.CreateSystem<ValueSystem>();
+        world.CreateSystem<TransformSystem>();
+        ObjectCollection objects;
+        world.CreateObjects<Value, Transform>(1000000, objects);
+        world.Update(0);
+        Begin();
+        world.Clear();
+        End();
+    });
+    
+    AddTest("Defragment in 1ms steps after removing 90% of 100000 objects", [this]() {
+        GameWorld world;
+        ObjectCollection objects;
+        world.CreateObjects<Value, Transform>(100000, objects);
+        ObjectCollection removed;
+        for(int i=0; i<objects.size(); ++i) {
+            if (i % 10) {
+                removed.push_back(objects[i]);
+            }
+        }
+        world.RemoveObjects(removed);
+        world.Update(0);
+        Begin();
+        while (!world.Defragment(0.001, 0)) { }
+        End();
+    });
+    
+    auto iterateLeftOver = [this] (bool defragment) {
+        struct TransformSystem : public GameSystem<Transform> {
+            float sum = 0;
+            void Update(float dt) override {
+                ForEach([this] (Transform& transform) {
+                    sum += transform.local[0];
+                });
+            }
+        };
+        GameWorld world;
+        world.CreateSystem<TransformSystem>();
+        ObjectCollection objects;
+        world.CreateObjects<Transform>(100000, objects);
+        ObjectCollection removed;
+        for(int i=0; i<objects.size(); ++i) {
+            if (i % 10) {
+                removed.push_back(objects[i]);
+            }
+        }
+        world.RemoveObjects(removed);
+        world.Update(0);
+        if (defragment) {
+            world.Defragment(0, 0);
+        }
+        Begin();
+        for(int i=0; i<1000; ++i) {
+            world.Update(0);
+        }
+        End();
+    };
+    
+    AddTest("ForEach over 10000 of 100000 objects left x 1000", [iterateLeftOver]() {
+        iterateLeftOver(false);
+    });
+    
+    AddTest("ForEach over 10000 of 100000 objects left x 1000, defragmented", [iterateLeftOver]() {
+        iterateLeftOver(true);
+    });
+    
+}
@@ -0,0 +1,131 @@
+//
+//  ThreadPool.cpp
+//  EntitySystem
+//
+//  Created by Jeppe Nielsen on 17/10/26.
+//  Copyright © 2026 Jeppe Nielsen. All rights reserved.
+//
+
+#include "ThreadPool.hpp"
+
+using namespace Pocket;
+
+namespace {
+    thread_local const ThreadPool* currentPool = 0;
+    thread_local int currentQueue = 0;
+}
+
+ThreadPool::ThreadPool() : queued(0), stopping(false) { }
+
+ThreadPool::~ThreadPool() {
+    Stop();
+}
+
+void ThreadPool::SetWorkerCount(int count) {
+    if (count == WorkerCount()) return;
+    Stop();
+    if (count == 0) return;
+    stopping = false;
+    for(int i=0; i<=count; ++i) {
+        queues.emplace_back(new Queue());
+    }
+    for(int i=0; i<count; ++i) {
+        threads.emplace_back(&ThreadPool::WorkerLoop, this, i + 1);
+    }
+}
+
+int ThreadPool::WorkerCount() const {
+    return (int)threads.size();
+}
+
+void ThreadPool::Run(Group& group, Function function, void* data, int index) {
+    if (threads.empty()) {
+        function(data, index);
+        return;
+    }
+    ++group.pending;
+    Queue& queue = *queues[ThreadIndex()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back({ function, data, index, &group });
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        ++queued;
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::Wait(Group& group) {
+    int queueIndex = ThreadIndex();
+    while (!group.IsDone()) {
+        if (!TryRunTask(queueIndex)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+bool ThreadPool::TryRunTask(int queueIndex) {
+    Task task;
+    bool found = false;
+    {
+        Queue& own = *queues[queueIndex];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            found = true;
+        }
+    }
+    for(int i=1; !found && i<queues.size(); ++i) {
+        Queue& other = *queues[(queueIndex + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if (!other.tasks.empty()) {
+            task = other.tasks.front();
+            other.tasks.pop_front();
+            found = true;
+        }
+    }
+    if (!found) return false;
+    --queued;
+    task.function(task.data, task.index);
+    --task.group->pending;
+    return true;
+}
+
+void ThreadPool::WorkerLoop(int queueIndex) {
+    currentPool = this;
+    currentQueue = queueIndex;
+    while (true) {
+        if (TryRunTask(queueIndex)) continue;
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this] { return stopping || queued>0; });
+        if (stopping) return;
+    }
+}
+
+void ThreadPool::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+    queues.clear();
+}
+
+int ThreadPool::RangeSize(int count, int grainSize, Partition partition) const {
+    if (partition == Partition::Deterministic) {
+        return grainSize>0 ? grainSize : 256;
+    }
+    int smallest = grainSize>0 ? grainSize : 64;
+    int target = count / ((WorkerCount() + 1) * 8);
+    return std::max(smallest, target);
+}
+
+int ThreadPool::ThreadIndex() const {
+    return currentPool == this ? currentQueue : 0;
+}
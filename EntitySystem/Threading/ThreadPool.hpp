@@ -0,0 +1,147 @@
+//
+//  ThreadPool.hpp
+//  EntitySystem
+//
+//  Created by Jeppe Nielsen on 17/10/26.
+//  Copyright © 2026 Jeppe Nielsen. All rights reserved.
+//
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Pocket {
+
+    // How ParallelFor splits [0, count) into ranges.
+    // Adaptive picks the range size from the count and the number of workers,
+    // Deterministic always uses ranges of grainSize, so the same count gives the same ranges on any machine.
+    enum class Partition {
+        Adaptive,
+        Deterministic,
+    };
+
+    // Work stealing thread pool, every worker owns a queue and takes work from the back of it,
+    // idle workers steal from the front of other queues.
+    // Threads calling Wait help running tasks until their group is done.
+    class ThreadPool {
+    public:
+        using Function = void(*)(void* data, int index);
+
+        class Group {
+        public:
+            Group() : pending(0) {}
+            bool IsDone() const { return pending == 0; }
+        private:
+            std::atomic<int> pending;
+            friend class ThreadPool;
+        };
+
+        ThreadPool();
+        ~ThreadPool();
+
+        // 0 workers runs every task directly on the calling thread
+        void SetWorkerCount(int count);
+        int WorkerCount() const;
+
+        // Index of the calling thread, 1 to WorkerCount for workers and 0 for any other thread.
+        int ThreadIndex() const;
+
+        void Run(Group& group, Function function, void* data, int index);
+        void Wait(Group& group);
+
+        // Calls body(begin, end) for ranges covering [0, count), possibly concurrently.
+        // Ranges are split recursively in halves, so idle workers steal the largest ranges first.
+        // grainSize is the smallest range for Adaptive, and the range size for Deterministic, 0 uses a default.
+        template<typename Body>
+        void ParallelFor(int count, int grainSize, Partition partition, Body& body);
+
+    private:
+        struct Task {
+            Function function;
+            void* data;
+            int index;
+            Group* group;
+        };
+
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        using Queues = std::vector<std::unique_ptr<Queue>>;
+        Queues queues;
+        std::vector<std::thread> threads;
+
+        std::mutex sleepMutex;
+        std::condition_variable wake;
+        std::atomic<int> queued;
+        bool stopping;
+
+        template<typename Body>
+        struct Ranges {
+            ThreadPool* pool;
+            Group* group;
+            Body* body;
+            int count;
+            int rangeSize;
+            int rangeCount;
+        };
+
+        template<typename Body>
+        static void RunRanges(void* data, int node);
+
+        int RangeSize(int count, int grainSize, Partition partition) const;
+
+        bool TryRunTask(int queueIndex);
+        void WorkerLoop(int queueIndex);
+        void Stop();
+    };
+
+    template<typename Body>
+    void ThreadPool::ParallelFor(int count, int grainSize, Partition partition, Body& body) {
+        if (count<=0) return;
+        int rangeSize = RangeSize(count, grainSize, partition);
+        int rangeCount = (count + rangeSize - 1) / rangeSize;
+        if (threads.empty()) {
+            for(int i=0; i<rangeCount; ++i) {
+                body(i * rangeSize, std::min(count, (i + 1) * rangeSize));
+            }
+            return;
+        }
+        Group group;
+        Ranges<Body> ranges { this, &group, &body, count, rangeSize, rangeCount };
+        RunRanges<Body>(&ranges, 1);
+        Wait(group);
+    }
+
+    // node is a position in an implicit binary tree over the ranges, node 1 covers all of them,
+    // and the children of node n are 2n and 2n + 1.
+    template<typename Body>
+    void ThreadPool::RunRanges(void* data, int node) {
+        Ranges<Body>& ranges = *static_cast<Ranges<Body>*>(data);
+        int begin = 0;
+        int end = ranges.rangeCount;
+        int depth = 0;
+        while ((node >> depth) > 1) ++depth;
+        for(int bit = depth - 1; bit>=0; --bit) {
+            int middle = (begin + end) / 2;
+            if ((node >> bit) & 1) {
+                begin = middle;
+            } else {
+                end = middle;
+            }
+        }
+        while (end - begin > 1) {
+            ranges.pool->Run(*ranges.group, &ThreadPool::RunRanges<Body>, data, node * 2 + 1);
+            node *= 2;
+            end = (begin + end) / 2;
+        }
+        (*ranges.body)(begin * ranges.rangeSize, std::min(ranges.count, end * ranges.rangeSize));
+    }
+}